@@ -50,4 +50,7 @@ typedef void (*local_idt_handler_t)(struct idt_data*);
 /* This function is used to modify the handler associated to a interrupt. */
 void idt_set_handler(unsigned int interrupt_code, local_idt_handler_t handler);
 
+/* This function makes an interrupt switch to the task of a TSS selector. */
+void idt_set_task_gate(unsigned int interrupt_code, unsigned short selector);
+
 #endif // ARCH_X86_IDT_H_
@@ -0,0 +1,32 @@
+/*
+ * This file is part of NativeOS
+ * Copyright (C) 2015-2022 The NativeOS contributors
+ * SPDX-License-Identifier:  GPL-3.0-only
+ */
+
+#pragma once
+
+/**
+ * \file
+ * \brief Task state segments
+ *
+ * The kernel does not use hardware task switching, except for one case: a
+ * double fault switches to a task that has its own stack.  A kernel stack
+ * overflow hits the guard page below the stack, and the processor cannot
+ * push the page fault on the same stack, so it raises a double fault.
+ * Without a separate task, that would also fail and reset the machine.
+ */
+
+/** Segment selector of the TSS that holds the state of the kernel.  */
+#define TSS_KERNEL_SELECTOR 0x18
+
+/** Segment selector of the TSS of the double fault task.  */
+#define TSS_DOUBLE_FAULT_SELECTOR 0x20
+
+/**
+ * \brief Install the task state segments and the double fault task.
+ *
+ * The double fault task runs with the page directory that is in use when
+ * this function is called, so it must be called once paging is enabled.
+ */
+void tss_init(void);
@@ -30,6 +30,48 @@
 
 #include <stddef.h>
 
+/** Number of size classes.  There is a class per bit in a size_t.  */
+#define HEAP_CLASSES 32
+
+/**
+ * \brief Heap statistics
+ *
+ * A snapshot of the state of the kernel heap, as returned by heap_get_stats.
+ * Sizes are expressed in bytes.  Control blocks are not accounted as used
+ * or free bytes.
+ */
+struct heap_stats {
+	/** Size of the whole heap, including the control blocks.  */
+	size_t total_bytes;
+	/** Bytes in the data regions of the allocated blocks, including the
+	 * blocks kept in the per processor magazines.  */
+	size_t used_bytes;
+	/** Bytes in the data regions of the free blocks.  */
+	size_t free_bytes;
+	/** Size of the data region of the largest free block.  */
+	size_t largest_free;
+	/** Amount of blocks in the heap, either allocated or free.  */
+	unsigned int blocks;
+	/** Amount of free blocks in the heap.  */
+	unsigned int free_blocks;
+	/** Amount of successful allocations since the heap was initialised.  */
+	unsigned int allocs;
+	/** Amount of deallocations since the heap was initialised.  */
+	unsigned int frees;
+	/** Amount of allocations that could not be satisfied.  */
+	unsigned int failures;
+	/** Amount of allocated blocks kept in the per processor magazines,
+	 * ready to be handed out again.  */
+	unsigned int cached_blocks;
+	/** Amount of blocks in the emergency pool.  */
+	unsigned int pool_blocks;
+	/** Amount of blocks of the emergency pool handed out.  */
+	unsigned int pool_used;
+	/** Amount of free blocks in each size class.  Class N holds the free
+	 * blocks whose size is in the [2^N, 2^(N+1)) range.  */
+	unsigned int classes[HEAP_CLASSES];
+};
+
 /**
  * \brief Initialises the kernel heap.
  *
@@ -52,6 +94,36 @@ void heap_init();
  */
 void * heap_alloc(size_t size);
 
+/**
+ * \brief Allocate an aligned memory region in the heap.
+ *
+ * Works like heap_alloc, but the address of the first byte of the memory
+ * region will be a multiple of the given alignment.  The memory region can
+ * be freed with heap_free as usual.
+ *
+ * \param size the amount of bytes that the kernel wants to have allocated.
+ * \param align the required alignment, which must be a power of two.
+ * \return either a pointer to a memory region, or NULL in case of error.
+ */
+void * heap_alloc_aligned(size_t size, size_t align);
+
+/**
+ * \brief Change the size of a memory region in the heap.
+ *
+ * If the memory region can be resized in place (because it is shrinking or
+ * because the memory region that follows it is free and big enough), the same
+ * pointer is returned.  Otherwise, a new memory region is allocated, the
+ * contents of the old memory region are copied into the new one, and the old
+ * memory region is freed.  If ptr is NULL, this works like heap_alloc.  If
+ * size is zero, this works like heap_free.
+ *
+ * \param ptr a pointer to the memory region to resize.
+ * \param size the new amount of bytes for the memory region.
+ * \return either a pointer to the memory region, or NULL in case of error,
+ *         in which case the original memory region is left untouched.
+ */
+void * heap_realloc(void * ptr, size_t size);
+
 /**
  * \brief Free a memory region from the heap.
  *
@@ -64,3 +136,71 @@ void * heap_alloc(size_t size);
  * \param ptr a pointer to the memory region to free.
  */
 void heap_free(void * ptr);
+
+/**
+ * \brief Allocate a block from the emergency pool.
+ *
+ * Unlike heap_alloc, this function never waits for a lock, so it can be
+ * used from interrupt handlers.  The pool is small and every block has the
+ * same size, so this should only be used when heap_alloc cannot.
+ *
+ * \param size the amount of bytes required, at most HEAP_POOL_BLOCK_SIZE.
+ * \return either a pointer to a block, or NULL if the pool is exhausted or
+ *         the size doesn't fit in a block.
+ */
+void * heap_pool_alloc(size_t size);
+
+/**
+ * \brief Return a block to the emergency pool.
+ *
+ * Like heap_pool_alloc, this function can be used from interrupt handlers.
+ * A pointer that is not the start of a block of the pool is ignored.
+ *
+ * \param ptr a pointer returned by heap_pool_alloc.
+ */
+void heap_pool_free(void * ptr);
+
+/**
+ * \brief Get the current statistics of the kernel heap.
+ * \param stats the structure where the statistics will be copied to.
+ */
+void heap_get_stats(struct heap_stats * stats);
+
+/** Amount of return addresses recorded per heap trace entry.  */
+#define HEAPTRACE_DEPTH 3
+
+#define HEAPTRACE_ALLOC 1 /**< The trace entry is an allocation. */
+#define HEAPTRACE_FREE 2  /**< The trace entry is a deallocation. */
+
+/**
+ * \brief Heap trace entry
+ *
+ * When the kernel is built with the heaptrace option, every allocation and
+ * deallocation is recorded in a ring buffer, together with the return
+ * addresses of the functions that asked for it.
+ */
+struct heaptrace_entry {
+	/** Either HEAPTRACE_ALLOC or HEAPTRACE_FREE.  */
+	unsigned int op;
+	/** The memory region, NULL for failed allocations.  */
+	void * ptr;
+	/** Requested size for allocations, region size for deallocations.  */
+	size_t size;
+	/** Timer ticks when the entry was recorded.  */
+	unsigned long ticks;
+	/** Return addresses, the innermost first.  */
+	void * callers[HEAPTRACE_DEPTH];
+};
+
+/**
+ * \brief Copy the most recent heap trace entries.
+ *
+ * Entries are copied from the oldest to the newest.  Only available when the
+ * kernel is built with the heaptrace option.
+ *
+ * \param entries the array where the trace entries will be copied to.
+ * \param count the amount of entries that fit in the array.
+ * \return the amount of entries copied into the array.
+ */
+unsigned int heaptrace_read(struct heaptrace_entry * entries,
+		unsigned int count);
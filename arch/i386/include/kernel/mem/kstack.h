@@ -0,0 +1,84 @@
+/*
+ * This file is part of NativeOS
+ * Copyright (C) 2015-2022 The NativeOS contributors
+ * SPDX-License-Identifier:  GPL-3.0-only
+ */
+
+#pragma once
+
+/**
+ * \file
+ * \brief Kernel stacks
+ *
+ * Kernel stacks are placed in the vmalloc window, so that the page below
+ * each stack is never mapped.  A stack overflow faults on that page instead
+ * of silently corrupting the memory below the stack.
+ *
+ * Every stack is painted with a known pattern when it is created.  Since a
+ * stack grows down, the lowest word that doesn't hold the pattern anymore
+ * tells how deep the stack has ever been, which is its high-water mark.
+ */
+
+#include <stddef.h>
+
+typedef struct kstack kstack_t;
+
+/**
+ * \brief Usage of a kernel stack
+ */
+struct kstack_info {
+	const char *name;
+	/** Size of the stack, in bytes.  */
+	unsigned int size;
+	/** Amount of bytes of the stack that have ever been used.  */
+	unsigned int used;
+};
+
+/**
+ * \brief Create the stack used by the kernel after boot.
+ *
+ * The boot stack is a static buffer with nothing below it to catch an
+ * overflow, so locore.S moves to this stack before calling kernel_main.
+ * The stack is KERNEL_STACK_SIZE bytes long.
+ *
+ * \return the address of the top of the new stack.
+ */
+unsigned int kstack_init(void);
+
+/**
+ * \brief Create a kernel stack.
+ *
+ * Every page of the stack is mapped and painted here, because a stack
+ * cannot rely on the page fault handler to be populated.
+ *
+ * \param name a descriptive name for the stack, for the report.
+ * \param size the size of the stack, rounded up to whole pages.
+ * \return the new stack, or NULL in case of error.
+ */
+kstack_t *kstack_create(const char *name, size_t size);
+
+/**
+ * \brief Get the initial value of the stack pointer for a kernel stack.
+ * \param stack the kernel stack.
+ * \return the address past the highest byte of the stack.
+ */
+unsigned int kstack_top(kstack_t *stack);
+
+/**
+ * \brief Release a kernel stack, which must not be in use anymore.
+ * \param stack the kernel stack.
+ */
+void kstack_destroy(kstack_t *stack);
+
+/**
+ * \brief Measure the high-water mark of every kernel stack.
+ *
+ * Each stack is scanned from the bottom up to the first word that no
+ * longer holds the paint, so this takes time proportional to the unused
+ * part of each stack.
+ *
+ * \param info where to store the usage of each stack.
+ * \param count the amount of entries in info.
+ * \return the amount of entries filled in.
+ */
+unsigned int kstack_report(struct kstack_info *info, unsigned int count);
@@ -17,7 +17,91 @@
  */
 #pragma once
 
+#include <config.h>
+
+#ifdef PAE
+/* PAE paging can reach physical memory above 4 GB.  */
+typedef unsigned long long physaddr_t;
+#else
 typedef unsigned int physaddr_t;
+#endif
+
+/** Number of block orders handled by the buddy allocator (0 up to 10).  */
+#define PMM_ORDERS 11
+
+/** Memory below 16 MB, which can be reached by ISA DMA devices.  */
+#define PMM_ZONE_DMA 0
+
+/** Memory above 16 MB, up to the end of the direct map.  */
+#define PMM_ZONE_NORMAL 1
+
+/**
+ * Memory past the end of the direct map, which includes the memory above
+ * 4 GB when the kernel is built with PAE.  The kernel can only reach these
+ * pages once they are mapped somewhere, so they are handed out one by one
+ * (order 0 only), and they are never zeroed in advance.
+ */
+#define PMM_ZONE_HIGH 2
+
+#define PMM_ZONES 3
+
+/**
+ * Can be combined with a zone to only take memory from that zone, instead
+ * of falling back to the zones below it when it has no free memory.
+ */
+#define PMM_ZONE_EXACT 0x10
+
+/* Owners of page frames, as recorded in the page frame database.  */
+#define PMM_OWNER_NONE     0 /**< Free, or not available memory.  */
+#define PMM_OWNER_KERNEL   1 /**< Kernel image.  */
+#define PMM_OWNER_PMM      2 /**< Page frame database.  */
+#define PMM_OWNER_MODULE   3 /**< Multiboot modules.  */
+#define PMM_OWNER_HEAP     4 /**< Kernel heap.  */
+#define PMM_OWNER_SLAB     5 /**< Object cache slabs.  */
+#define PMM_OWNER_PAGING   6 /**< Page tables.  */
+#define PMM_OWNER_VMALLOC  7 /**< Pages of vmalloc ranges.  */
+#define PMM_OWNER_FIRMWARE 8 /**< First megabyte of memory.  */
+#define PMM_OWNER_BOOTINFO 9 /**< Multiboot information and tables.  */
+
+/**
+ * The frame was reserved during boot and is not managed by the allocator.
+ * Dropping references never frees it; only pmm_reclaim can release it.
+ */
+#define PMM_FRAME_RESERVED 0x01
+
+/**
+ * The reference count sticks once it reaches this value, since the count
+ * is lost.  The frame is pinned and never goes back to the free lists.
+ */
+#define PMM_REFCOUNT_MAX 0xFFFF
+
+/**
+ * \brief Page frame descriptor
+ *
+ * There is a descriptor for every page frame in the page frame database.
+ * The reference count starts at 1 when the frame is allocated, and the
+ * frame only goes back to the free lists when the last reference is
+ * dropped.
+ */
+struct pmm_frame {
+	unsigned short refcount;
+	unsigned char flags;
+	unsigned char owner;
+};
+
+/**
+ * \brief Physical memory counters
+ *
+ * Counters are expressed in page frames, one entry per zone.  The total
+ * amount only accounts frames managed by the allocator, so the memory
+ * reserved during boot is not included.
+ */
+struct pmm_stats {
+	unsigned int total[PMM_ZONES];
+	unsigned int free[PMM_ZONES];
+	/** Frames kept zeroed in advance, not counted as free.  */
+	unsigned int zeroed;
+};
 
 /**
  * \brief Initialize the physical memory manager subsystem.
@@ -26,12 +110,114 @@ void pmm_init();
 
 /**
  * \brief Allocate a 4 KB page in the physical memory of the computer.
+ *
+ * The zone is a hint: if the zone has no free memory, the page is taken
+ * from the zones below it.  Use PMM_ZONE_DMA only when the page must be
+ * reachable by ISA DMA devices.
+ *
+ * \param zone the preferred zone for the page.
+ * \param owner who is going to use the page, one of the PMM_OWNER values.
  * \return The allocated physical memory address, 0 if no free page is found.
  */
-physaddr_t pmm_alloc_page();
+physaddr_t pmm_alloc_page(unsigned int zone, unsigned int owner);
 
 /**
- * \brief Free a 4 KB page from the physical memory of the computer.
+ * \brief Drop a reference to a 4 KB page of the physical memory.
+ *
+ * The page is given back to the free lists once the last reference to it
+ * is dropped.
+ *
  * \param page the memory address of the page to free up from memory.
  */
 void pmm_free_page(physaddr_t page);
+
+/**
+ * \brief Allocate a 4 KB page full of zeros.
+ *
+ * Pages of the normal zone are served from the pool of pages zeroed in
+ * advance when possible, so the page doesn't need to be cleared while the
+ * caller waits.  Otherwise, this works like pmm_alloc_page followed by
+ * clearing the page.  Highmem cannot be cleared here, so PMM_ZONE_HIGH is
+ * treated as PMM_ZONE_NORMAL.
+ *
+ * \param zone the preferred zone for the page.
+ * \param owner who is going to use the page, one of the PMM_OWNER values.
+ * \return The allocated physical memory address, 0 if no free page is found.
+ */
+physaddr_t pmm_alloc_zeroed_page(unsigned int zone, unsigned int owner);
+
+/**
+ * \brief Zero a page in advance for pmm_alloc_zeroed_page.
+ *
+ * Meant to be called when the system is idle.  Each call clears at most one
+ * page, so that it doesn't take long.
+ *
+ * \return non-zero if a page was added to the pool, zero if the pool is full
+ *         or there is no free memory.
+ */
+int pmm_refill_zeroed();
+
+/**
+ * \brief Allocate a block of contiguous pages in the physical memory.
+ *
+ * The block is made of 2^order pages, and its physical address is aligned
+ * to the size of the block.
+ *
+ * \param order the order of the block, from 0 (4 KB) up to 10 (4 MB).
+ * \param zone the preferred zone for the block.
+ * \param owner who is going to use the block, one of the PMM_OWNER values.
+ * \return The allocated physical memory address, 0 if no free block is found.
+ */
+physaddr_t
+pmm_alloc_pages(unsigned int order, unsigned int zone, unsigned int owner);
+
+/**
+ * \brief Free a block of contiguous pages allocated with pmm_alloc_pages.
+ *
+ * For blocks, the reference count of the first page is the one that counts.
+ *
+ * \param addr the memory address of the block to free up from memory.
+ * \param order the order the block was allocated with.
+ */
+void pmm_free_pages(physaddr_t addr, unsigned int order);
+
+/**
+ * \brief Take an additional reference to an allocated page.
+ *
+ * A page that reaches PMM_REFCOUNT_MAX references is pinned for good.
+ *
+ * \param page the memory address of the page.
+ */
+void pmm_page_ref(physaddr_t page);
+
+/**
+ * \brief Give memory reserved during boot back to the allocator.
+ *
+ * Only the memory of the multiboot modules (PMM_OWNER_MODULE) and of the
+ * multiboot information (PMM_OWNER_BOOTINFO) can be reclaimed, once it is
+ * not going to be read anymore; for instance, after the contents of a
+ * module have been copied elsewhere.  Only the page frames that fit
+ * completely inside the region and that were reserved for the given owner
+ * are released, so a frame shared with other data is kept.  A frame still
+ * referenced through pmm_page_ref stops being reserved, but it is only
+ * given back when the last reference is dropped with pmm_free_page.
+ *
+ * \param start the first address of the memory region.
+ * \param end the address that follows the memory region.
+ * \param owner the owner the memory region was reserved for.
+ * \return the amount of page frames given back straight away.
+ */
+unsigned int pmm_reclaim(physaddr_t start, physaddr_t end, unsigned int owner);
+
+/**
+ * \brief Get the descriptor of a page frame.
+ * \param page the memory address of the page.
+ * \return the descriptor, or NULL if the page is not managed.
+ */
+struct pmm_frame *pmm_frame_of(physaddr_t page);
+
+/**
+ * \brief Take a snapshot of the physical memory counters.
+ * \param stats where to store the snapshot.
+ */
+void pmm_get_stats(struct pmm_stats *stats);
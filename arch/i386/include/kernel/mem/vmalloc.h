@@ -0,0 +1,85 @@
+/*
+ * This file is part of NativeOS
+ * Copyright (C) 2015-2022 The NativeOS contributors
+ * SPDX-License-Identifier:  GPL-3.0-only
+ */
+
+#pragma once
+
+/**
+ * \file
+ * \brief Virtually contiguous kernel allocations
+ *
+ * Big buffers don't need to be physically contiguous, and taking them from
+ * the heap fragments it.  vmalloc only reserves a range of the vmalloc
+ * window, and page frames are mapped into the range the first time each
+ * page is touched, so memory is only committed when it is used.
+ */
+
+#include <machine/paging.h>
+#include <stddef.h>
+
+/**
+ * \brief Initialise the vmalloc window.
+ *
+ * Installs the page fault handler that populates the reserved ranges, so it
+ * must be called once paging has been enabled.
+ */
+void vmalloc_init(void);
+
+/**
+ * \brief Reserve a virtually contiguous memory region.
+ *
+ * The memory region is rounded up to whole pages, and it reads as zeros.
+ * The page that follows the memory region is never mapped, so overflowing
+ * the region faults instead of corrupting another region.
+ *
+ * \param size the amount of bytes to reserve.
+ * \return a pointer to the memory region, or NULL in case of error.
+ */
+void *vmalloc(size_t size);
+
+/**
+ * \brief Map a private, copy-on-write view of existing memory.
+ *
+ * The page frames that hold the memory region are mapped read-only into a
+ * new range, so no memory is copied.  The first write to each page of the
+ * range copies that page, so writes are never seen by the original memory
+ * region.  This is meant for big memory regions that are mostly read, such
+ * as the contents of a file in the ramdisk (see fs_mmap).
+ *
+ * Since whole pages are mapped, the bytes that share a page with the start
+ * or the end of the memory region can also be read through the range.
+ *
+ * \param data the first byte of the memory region, which must be mapped.
+ * \param size the size of the memory region.
+ * \return a pointer to the view of data, or NULL in case of error.
+ */
+void *vmap_private(const void *data, size_t size);
+
+/**
+ * \brief Map a physical memory region into the vmalloc window.
+ *
+ * This is meant for big, physically contiguous regions such as a linear
+ * framebuffer.  The range is placed so that every large page sized block of
+ * the region is mapped with a single large page (see vmm_map_range), and
+ * the rest of the region is mapped with 4 KB pages.
+ *
+ * \param phys the physical address of the memory region.
+ * \param size the size of the memory region.
+ * \param flags a combination of the VMM flags, such as VMM_WRITE.
+ * \return a pointer to the mapped region, or NULL in case of error.
+ */
+void *vmap_physical(physaddr_t phys, size_t size, unsigned int flags);
+
+/**
+ * \brief Release a memory region reserved with vmalloc, vmap_private or
+ *        vmap_physical.
+ *
+ * The page frames that were committed to the memory region are given back
+ * to the physical memory manager, except those of a physical memory region,
+ * which are only unmapped.
+ *
+ * \param ptr the pointer returned by vmalloc, vmap_private or vmap_physical.
+ */
+void vfree(void *ptr);
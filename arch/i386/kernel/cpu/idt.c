@@ -82,6 +82,12 @@ void idt_set_handler(unsigned int interrupt_code, local_idt_handler_t handler)
 	idt_handlers[interrupt_code] = handler;
 }
 
+void idt_set_task_gate(unsigned int interrupt_code, unsigned short selector)
+{
+	if (interrupt_code >= INTERRUPTS) return;
+	idt_set_entry(interrupt_code, 0, selector, 0x85);
+}
+
 void idt_init()
 {
 	/* Create the IDT table. */
@@ -116,11 +122,14 @@ void idt_handler(struct idt_data* data)
 		idt_handlers[data->int_no](data);
 	} else {
 		fallback_handler(data);
-	}
 
-	/* If this is an exception, I have to halt the system (I think?) */
-	if (data->int_no < 16)
-		kernel_die();
+		/*
+		 * Nobody can recover from this exception. Exceptions with a
+		 * handler, such as page faults, are up to the handler.
+		 */
+		if (data->int_no < 16)
+			kernel_die();
+	}
 
 	/*
 	 * Acknowledge the interrupt to PIC1. If the interrupt came from,
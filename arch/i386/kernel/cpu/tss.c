@@ -0,0 +1,109 @@
+/*
+ * This file is part of NativeOS
+ * Copyright (C) 2015-2022 The NativeOS contributors
+ * SPDX-License-Identifier:  GPL-3.0-only
+ */
+
+/**
+ * \file tss.c
+ * \brief i386 task state segments
+ *
+ * Two task state segments are installed in the GDT.  The kernel TSS is the
+ * one loaded in the task register, so that the processor has somewhere to
+ * save the state of the kernel when it switches tasks.  The double fault
+ * TSS describes a task that runs on a small stack of its own.  Vector 8 of
+ * the IDT is a task gate for this task, so a double fault is handled even
+ * when the kernel stack is unusable.
+ *
+ * The double fault task halts the system.  The state of the kernel at the
+ * time of the fault, including the stack pointer, is left in the kernel TSS
+ * for the debugger.
+ */
+
+#include <kernel/cpu/idt.h>
+#include <kernel/cpu/tss.h>
+
+/** Size of the stack used by the double fault task.  */
+#define TSS_DOUBLE_FAULT_STACK 0x1000
+
+/** Vector of the double fault exception.  */
+#define TSS_DOUBLE_FAULT 8
+
+struct tss {
+	unsigned short link, reserved0;
+	unsigned int esp0;
+	unsigned short ss0, reserved1;
+	unsigned int esp1;
+	unsigned short ss1, reserved2;
+	unsigned int esp2;
+	unsigned short ss2, reserved3;
+	unsigned int cr3, eip, eflags;
+	unsigned int eax, ecx, edx, ebx, esp, ebp, esi, edi;
+	unsigned short es, reserved4;
+	unsigned short cs, reserved5;
+	unsigned short ss, reserved6;
+	unsigned short ds, reserved7;
+	unsigned short fs, reserved8;
+	unsigned short gs, reserved9;
+	unsigned short ldt, reserved10;
+	unsigned short trap, iomap;
+} __attribute__((packed));
+
+/* Descriptors of the GDT, defined in locore.S.  */
+extern unsigned int gdt_table[];
+
+extern void kernel_die(void);
+
+static struct tss tss_kernel;
+static struct tss tss_double_fault;
+
+static unsigned char tss_double_fault_stack[TSS_DOUBLE_FAULT_STACK]
+    __attribute__((aligned(16)));
+
+/**
+ * \brief Fill the GDT descriptor for a task state segment.
+ * \param selector the segment selector of the descriptor.
+ * \param tss the task state segment.
+ */
+static void
+tss_descriptor(unsigned short selector, struct tss *tss)
+{
+	unsigned int base = (unsigned int) tss, limit = sizeof(struct tss) - 1;
+	unsigned int *desc = &gdt_table[selector >> 2];
+
+	/* Present, ring 0, 32 bit available TSS, byte granularity.  */
+	desc[0] = (base << 16) | (limit & 0xFFFF);
+	desc[1] = (base & 0xFF000000) | (limit & 0xF0000) | 0x8900
+	    | ((base >> 16) & 0xFF);
+}
+
+static void
+tss_double_fault_task(void)
+{
+	/* Most likely the kernel stack overflowed into its guard page.  */
+	kernel_die();
+}
+
+void
+tss_init(void)
+{
+	struct tss *tss = &tss_double_fault;
+	unsigned int cr3;
+
+	__asm__ volatile("movl %%cr3, %0" : "=r"(cr3));
+	tss->cr3 = cr3;
+	tss->eip = (unsigned int) &tss_double_fault_task;
+	tss->eflags = 0x2;
+	tss->esp = (unsigned int) tss_double_fault_stack
+	    + TSS_DOUBLE_FAULT_STACK;
+	tss->cs = 0x08;
+	tss->ss = tss->ds = tss->es = tss->fs = tss->gs = 0x10;
+	tss->iomap = sizeof(struct tss);
+	tss_kernel.iomap = sizeof(struct tss);
+
+	tss_descriptor(TSS_KERNEL_SELECTOR, &tss_kernel);
+	tss_descriptor(TSS_DOUBLE_FAULT_SELECTOR, &tss_double_fault);
+	__asm__ volatile("ltr %w0" : : "r"(TSS_KERNEL_SELECTOR));
+
+	idt_set_task_gate(TSS_DOUBLE_FAULT, TSS_DOUBLE_FAULT_SELECTOR);
+}
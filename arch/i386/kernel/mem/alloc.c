@@ -39,3 +39,15 @@ free (void * ptr)
 {
 	heap_free(ptr);
 }
+
+void *
+realloc (void * ptr, size_t size)
+{
+	return heap_realloc(ptr, size);
+}
+
+void *
+aligned_alloc (size_t alignment, size_t size)
+{
+	return heap_alloc_aligned(size, alignment);
+}
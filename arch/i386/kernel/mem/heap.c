@@ -46,10 +46,96 @@
  * regions adjacent to the one that's being freed.  If two consecutive free
  * regions are found, those regions are merged into one consecutive and big
  * memory region.
+ *
+ * Free regions are not looked up by walking the linked list of control
+ * blocks, because that takes more time as the number of live objects grows.
+ * Instead, every free region is also linked into a segregated free list,
+ * depending on its size class.  The size class of a region is the position of
+ * the most significant bit of its size, so class N holds every free region
+ * whose size is in the [2^N, 2^(N+1)) range.  A bitmap keeps track of which
+ * classes are not empty, so that the first class that is able to satisfy a
+ * request can be found using a single bit scan.  The links of the free list
+ * are stored in the data region of the free memory region, so control blocks
+ * are not larger than they used to be.
+ *
+ * The heap starts as a small region reserved in the kernel image by the
+ * linker script, which is enough to hold the allocations made while the
+ * system boots.  Once paging is enabled, whenever no free region is big
+ * enough to hold an allocation, the heap grows into the heap window, a range
+ * of the kernel virtual memory reserved for the heap.  Page frames are
+ * requested to the physical memory manager and mapped contiguously at the
+ * end of the window that is in use, and the new space is linked as a free
+ * region at the end of the chain of control blocks.  The opposite happens
+ * when the last region in the heap window is freed and it is big enough:
+ * the trailing pages are unmapped and given back to the physical memory
+ * manager.
+ *
+ * Small data regions are not given back to the global heap right after being
+ * freed.  Each processor keeps a magazine per size bucket, which is a small
+ * stack of recently freed regions that are handed out again to allocations
+ * of the same bucket without taking the heap lock.  Magazines are refilled
+ * from the global heap and drained back to it in batches, so the lock is
+ * only taken once per batch.  If the global heap is exhausted, every region
+ * in the magazines is given back before giving up.
+ *
+ * A few counters are updated as the heap is used, so that the state of the
+ * heap can be inspected through heap_get_stats while the system runs.  Free
+ * regions are counted as they are linked into or unlinked from the free
+ * lists, so keeping the counters is cheap.
+ *
+ * Interrupt handlers cannot use the heap, because the code they interrupted
+ * may be holding the heap lock.  A small emergency pool of fixed size blocks
+ * is reserved when the heap is initialised for them.  Blocks are claimed and
+ * released with atomic bit operations on an allocation bitmap, so the pool
+ * never waits for anything.  The amount and the size of the blocks can be
+ * changed with the HEAP_POOL_BLOCKS and HEAP_POOL_BLOCK_SIZE defines.
+ *
+ * If the kernel is built with HEAPTRACE defined, every allocation and
+ * deallocation is also recorded in a ring buffer along with the return
+ * addresses of the callers, so that the call sites that allocate the most or
+ * that leak memory can be found.  Return addresses are taken by following
+ * the chain of saved frame pointers, so frame pointers must not be omitted.
  */
 
+#include <config.h>
 #include <kernel/mem/heap.h>
+#include <kernel/mem/pmm.h>
+#include <machine/paging.h>
 #include <sys/spinlock.h>
+#include <sys/stdkern.h>
+
+#ifndef HEAP_POOL_BLOCKS
+#define HEAP_POOL_BLOCKS 32
+#endif
+
+/* Must be a multiple of the pointer size to keep blocks aligned.  */
+#ifndef HEAP_POOL_BLOCK_SIZE
+#define HEAP_POOL_BLOCK_SIZE 64
+#endif
+
+#ifdef HEAPTRACE
+#include <device/pctimer.h>
+
+#ifndef HEAPTRACE_ENTRIES
+#define HEAPTRACE_ENTRIES 512
+#endif
+
+/* Ring buffer of heap trace entries.  */
+static struct heaptrace_entry heaptrace_ring[HEAPTRACE_ENTRIES];
+
+/* Amount of entries ever recorded.  The next one goes to this index modulus
+ * the size of the ring buffer.  */
+static unsigned int heaptrace_count;
+
+/* Farthest a caller's frame can be from the frame of its callee.  */
+#define HEAPTRACE_FRAME_SPAN 0x4000
+
+/* Record an entry, must be used from the function called by the caller.  */
+#define HEAPTRACE_RECORD(op, ptr, size) \
+	heaptrace_record((op), (ptr), (size), __builtin_frame_address(0))
+#else
+#define HEAPTRACE_RECORD(op, ptr, size)
+#endif
 
 /** Magic number that indicates that a heap control block follows.  */
 #define HEAP_MAGIC_HEAD 0x51514949
@@ -60,6 +146,48 @@
 /** Magic value that indicates that the current memory block is allocated.  */
 #define HEAP_MAGIC_USED 0xEFEFEFEF
 
+/** Data regions are always a multiple of this amount of bytes.  */
+#define HEAP_ALIGN sizeof(void *)
+
+/** Smallest data region, it must be able to hold the free list links.  */
+#define HEAP_MIN_SIZE sizeof(heap_links_t)
+
+/** Maximum amount of processors.  */
+#define HEAP_CPUS 1
+
+/** Data regions handled by the magazines, by size, are multiple of this.  */
+#define HEAP_MAG_STEP 8
+
+/** Amount of magazines per processor.  Each one handles a bucket of sizes.  */
+#define HEAP_MAG_BUCKETS 32
+
+/** Largest data region that is allocated through the magazines.  */
+#define HEAP_MAG_MAX (HEAP_MAG_STEP * HEAP_MAG_BUCKETS)
+
+/** Capacity of a magazine.  */
+#define HEAP_MAG_ROUNDS 16
+
+/** Amount of data regions moved at once between a magazine and the heap.  */
+#define HEAP_MAG_BATCH 8
+
+/** First virtual address of the heap window.  */
+#define HEAP_WINDOW_START 0xD0000000
+
+/** Virtual address past the end of the heap window.  */
+#define HEAP_WINDOW_END 0xE0000000
+
+/** Largest request that could ever fit in the heap window.  */
+#define HEAP_MAX_SIZE (HEAP_WINDOW_END - HEAP_WINDOW_START)
+
+/** Minimum amount of bytes to map every time the heap grows.  */
+#define HEAP_GROW_MIN 0x10000
+
+/** Trailing free space in the heap window required to start trimming.  */
+#define HEAP_TRIM_MIN 0x20000
+
+/** Words in the allocation bitmap of the emergency pool.  */
+#define HEAP_POOL_WORDS ((HEAP_POOL_BLOCKS + 31) / 32)
+
 /** Points to a memory address related to the heap.  */
 typedef unsigned char * HEAP_ADDR;
 
@@ -80,12 +208,73 @@ typedef struct heap_block {
 	HEAP_SIZE size;
 } heap_block_t;
 
+/**
+ * \brief Free list links
+ *
+ * While a memory region is free, the first bytes of its data region are used
+ * to link the control block into the free list for its size class.  These
+ * links are meaningless once the memory region has been allocated.
+ */
+typedef struct heap_links {
+	heap_block_t *fnext, *fprev;
+} heap_links_t;
+
+/** Get the free list links for the given control block.  */
+#define HEAP_LINKS(block) ((heap_links_t *) ((HEAP_ADDR) (block) \
+	+ sizeof(heap_block_t)))
+
+/**
+ * \brief Magazine
+ *
+ * A magazine is a small LIFO stack of data regions that have been freed
+ * recently and that are kept allocated in the global heap, ready to be handed
+ * out again without taking the heap lock.  Each magazine holds data regions
+ * of a range of sizes (a bucket).
+ */
+typedef struct heap_magazine {
+	unsigned int count;
+	HEAP_ADDR rounds[HEAP_MAG_ROUNDS];
+} heap_magazine_t;
+
+/**
+ * \brief Per processor heap state
+ */
+struct heap_cpu {
+	heap_magazine_t mags[HEAP_MAG_BUCKETS];
+	/* Allocations and deallocations served by the magazines.  */
+	unsigned int allocs, frees;
+};
+
 /* This points to the root control block of the heap once it has been
  * initialised.  Control blocks are connected through a linked list.  The
  * allocator will traverse the linked list when looking for blocks marked as
  * free.  */
 static volatile heap_block_t * heap_root;
 
+/* Head of the free list for every size class.  */
+static heap_block_t * heap_free_lists[HEAP_CLASSES];
+
+/* Bit N is set when the free list for the size class N is not empty.  */
+static unsigned int heap_classes_map;
+
+/* Amount of control blocks in the chain.  */
+static unsigned int heap_blocks;
+
+/* Amount of bytes in the data regions of the free control blocks.  */
+static HEAP_SIZE heap_free_bytes;
+
+/* Amount of free control blocks in each size class.  */
+static unsigned int heap_free_count[HEAP_CLASSES];
+
+/* Amount of successful allocations, deallocations and failed allocations.  */
+static unsigned int heap_allocs, heap_frees, heap_failures;
+
+/* The last control block in the chain.  */
+static heap_block_t * heap_tail;
+
+/* Points past the last page that is mapped in the heap window.  */
+static HEAP_ADDR heap_brk = (HEAP_ADDR) HEAP_WINDOW_START;
+
 /* Defined in ldscript.  This symbol is located at the bottom of the kernel
  * heap.  Heap allocations should always start at a memory address that is
  * equal or greater than the memory address of this symbol.  */
@@ -99,8 +288,141 @@ extern volatile const unsigned char heap_top;
 /* Forbids multiple processors of allocating memory at the same time.  */
 static struct spinlock heap_allocator_spinlock;
 
+/* Magazines for every processor.  */
+static struct heap_cpu heap_cpus[HEAP_CPUS];
+
+/* Blocks of the emergency pool.  */
+static HEAP_ADDR heap_pool;
+
+/* Bit i is set while block i of the emergency pool is handed out.  */
+static volatile unsigned int heap_pool_map[HEAP_POOL_WORDS];
+
+/**
+ * \brief Get the index of the least significant bit set.
+ * \param map the value to scan, it must not be zero.
+ * \return the index of the least significant bit set in map.
+ */
+static inline unsigned int
+heap_bsf (unsigned int map)
+{
+	unsigned int index;
+	__asm__("bsfl %1, %0" : "=r"(index) : "rm"(map));
+	return index;
+}
+
+/**
+ * \brief Get the index of the most significant bit set.
+ * \param map the value to scan, it must not be zero.
+ * \return the index of the most significant bit set in map.
+ */
+static inline unsigned int
+heap_bsr (unsigned int map)
+{
+	unsigned int index;
+	__asm__("bsrl %1, %0" : "=r"(index) : "rm"(map));
+	return index;
+}
+
+/**
+ * \brief Get the size class for a data region of the given size.
+ * \param size the size of the data region, at least HEAP_MIN_SIZE bytes.
+ * \return the size class for the given size.
+ */
+static inline unsigned int
+heap_class (HEAP_SIZE size)
+{
+	return heap_bsr(size);
+}
+
+/**
+ * \brief Link a free control block into the free list for its size class.
+ * \param block the control block to insert in the free lists.
+ */
+static inline void
+heap_list (heap_block_t * block)
+{
+	unsigned int class = heap_class(block->size);
+	heap_links_t * links = HEAP_LINKS(block);
+
+	links->fprev = 0;
+	links->fnext = heap_free_lists[class];
+	if (links->fnext) {
+		HEAP_LINKS(links->fnext)->fprev = block;
+	}
+	heap_free_lists[class] = block;
+	heap_classes_map |= (1U << class);
+	heap_free_bytes += block->size;
+	heap_free_count[class]++;
+}
+
+/**
+ * \brief Unlink a free control block from the free list for its size class.
+ * \param block the control block to remove from the free lists.
+ */
+static inline void
+heap_unlist (heap_block_t * block)
+{
+	unsigned int class = heap_class(block->size);
+	heap_links_t * links = HEAP_LINKS(block);
+
+	if (links->fprev) {
+		HEAP_LINKS(links->fprev)->fnext = links->fnext;
+	} else {
+		heap_free_lists[class] = links->fnext;
+	}
+	if (links->fnext) {
+		HEAP_LINKS(links->fnext)->fprev = links->fprev;
+	}
+	if (!heap_free_lists[class]) {
+		heap_classes_map &= ~(1U << class);
+	}
+	heap_free_bytes -= block->size;
+	heap_free_count[class]--;
+}
+
+/**
+ * \brief Locate a free control block able to hold the given size.
+ *
+ * Any block in a class higher than the class for the given size is big
+ * enough, so the head of the first non empty class is picked.  Only if every
+ * higher class is empty, the free list for the class of the given size will
+ * be walked looking for a block that is big enough.
+ *
+ * \param size the size of the data region, already rounded.
+ * \return a free control block, or NULL if there are no blocks big enough.
+ */
+static heap_block_t *
+heap_find (HEAP_SIZE size)
+{
+	heap_block_t * block;
+	unsigned int class, first, map;
+
+	class = heap_class(size);
+
+	/* Every block in the class is big enough if size is a power of 2. */
+	first = (size == ((HEAP_SIZE) 1 << class)) ? class : class + 1;
+	map = first < HEAP_CLASSES ? heap_classes_map & (~0U << first) : 0;
+	if (map) {
+		return heap_free_lists[heap_bsf(map)];
+	}
+
+	/* Fallback to first-fit in the class for the given size.  */
+	for (block = heap_free_lists[class]; block;
+			block = HEAP_LINKS(block)->fnext) {
+		if (block->size >= size) {
+			return block;
+		}
+	}
+	return 0;
+}
+
 /**
  * \brief Attempt to merge the given heap control blocks.
+ *
+ * Both blocks must be free, which also means that they are linked into the
+ * free lists.  The merged block is linked back into the free list for the
+ * size class of the resulting block.
+ *
  * \param head the first memory block to merge.
  * \param tail the second memory block to merge.
  * \return pointer to the merged block, or NULL if no merge was made.
@@ -129,19 +451,231 @@ heap_merge (heap_block_t * head, heap_block_t * tail)
 		return 0;
 	}
 
+	/* The size class for head will change, and tail will disappear.  */
+	heap_unlist(head);
+	heap_unlist(tail);
+
 	/* Unlink tail from chain. */
 	if (tail->next) {
 		bound = (heap_block_t *) tail->next;
 		bound->prev = (HEAP_ADDR) head;
 	}
 	head->next = tail->next;
+	if (heap_tail == tail) {
+		heap_tail = head;
+	}
+	heap_blocks--;
 
 	/* Assignate the space for the control block and buffer to head. */
 	head->size += (sizeof(heap_block_t) + tail->size);
+	heap_list(head);
 
 	return head;
 }
 
+/**
+ * \brief Unmap a range of the heap window and release its page frames.
+ * \param start the first page of the range to release.
+ * \param end the address past the last page of the range to release.
+ */
+static void
+heap_release (HEAP_ADDR start, HEAP_ADDR end)
+{
+	physaddr_t frame;
+
+	for (; start < end; start += PAGE_SIZE) {
+		if ((frame = vmm_unmap((unsigned int) start)) != 0) {
+			pmm_free_page(frame);
+		}
+	}
+}
+
+/**
+ * \brief Grow the heap so that the given size can be allocated.
+ *
+ * Page frames are mapped at the end of the heap window that is in use.
+ * If the last control block is free and ends right where the new pages are
+ * mapped, it will absorb the new pages; otherwise a new free control block is
+ * created at the beginning of the new pages.
+ *
+ * \param size the size of the data region that is going to be allocated.
+ * \return zero if the heap could grow, non-zero otherwise.
+ */
+static int
+heap_grow (HEAP_SIZE size)
+{
+	HEAP_ADDR start, addr, tail_end;
+	HEAP_SIZE amount;
+	heap_block_t * block;
+	physaddr_t frame;
+
+	if (!paging_enabled()) {
+		/* The heap window is not available during early boot.  */
+		return -1;
+	}
+
+	if (size > HEAP_MAX_SIZE) {
+		/* Would not fit, and the sums below could overflow.  */
+		return -1;
+	}
+
+	/* Map space for a control block and the data region, at least.  */
+	amount = size + sizeof(heap_block_t);
+	if (amount < HEAP_GROW_MIN) {
+		amount = HEAP_GROW_MIN;
+	}
+	amount = (amount + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+	if (amount > (HEAP_SIZE) ((HEAP_ADDR) HEAP_WINDOW_END - heap_brk)) {
+		return -1;
+	}
+
+	start = heap_brk;
+	for (addr = start; addr < start + amount; addr += PAGE_SIZE) {
+		frame = pmm_alloc_page(PMM_ZONE_NORMAL, PMM_OWNER_HEAP);
+		if (frame == 0) {
+			heap_release(start, addr);
+			return -1;
+		}
+		if (vmm_map((unsigned int) addr, frame, VMM_WRITE) != 0) {
+			pmm_free_page(frame);
+			heap_release(start, addr);
+			return -1;
+		}
+	}
+	heap_brk = start + amount;
+
+	tail_end = (HEAP_ADDR) heap_tail + sizeof(heap_block_t)
+		+ heap_tail->size;
+	if (heap_tail->status == HEAP_MAGIC_FREE && tail_end == start) {
+		/* The last control block absorbs the new pages.  */
+		heap_unlist(heap_tail);
+		heap_tail->size += amount;
+		heap_list(heap_tail);
+	} else {
+		block = (heap_block_t *) start;
+		block->magic = HEAP_MAGIC_HEAD;
+		block->status = HEAP_MAGIC_FREE;
+		block->size = amount - sizeof(heap_block_t);
+		block->prev = (HEAP_ADDR) heap_tail;
+		block->next = 0;
+		heap_tail->next = (HEAP_ADDR) block;
+		heap_tail = block;
+		heap_blocks++;
+		heap_list(block);
+	}
+	return 0;
+}
+
+/**
+ * \brief Give back to the PMM the trailing free pages of the heap window.
+ *
+ * If the last control block is free, it lives in the heap window, and there
+ * are enough free bytes at the end of the window, the pages that are not
+ * required to hold the control block are unmapped and released.
+ */
+static void
+heap_trim (void)
+{
+	heap_block_t * block = heap_tail, * prev;
+	HEAP_ADDR blockptr = (HEAP_ADDR) block, keep;
+
+	if (block->status != HEAP_MAGIC_FREE
+			|| blockptr < (HEAP_ADDR) HEAP_WINDOW_START
+			|| blockptr + sizeof(heap_block_t) + block->size
+				!= heap_brk) {
+		return;
+	}
+
+	if (((unsigned int) blockptr & (PAGE_SIZE - 1)) == 0) {
+		/* The whole control block can go away.  */
+		keep = blockptr;
+	} else {
+		keep = blockptr + sizeof(heap_block_t) + HEAP_MIN_SIZE;
+		keep = (HEAP_ADDR) (((unsigned int) keep + PAGE_SIZE - 1)
+			& ~(PAGE_SIZE - 1));
+	}
+	if (heap_brk < keep + HEAP_TRIM_MIN) {
+		/* Not worth it yet.  */
+		return;
+	}
+
+	heap_unlist(block);
+	if (keep == blockptr) {
+		prev = (heap_block_t *) block->prev;
+		prev->next = 0;
+		heap_tail = prev;
+		heap_blocks--;
+	} else {
+		block->size = keep - blockptr - sizeof(heap_block_t);
+		heap_list(block);
+	}
+	heap_release(keep, heap_brk);
+	heap_brk = keep;
+}
+
+/**
+ * \brief Reserve the blocks of the emergency pool.
+ *
+ * Bits past the last block are set, so that they never look free.
+ */
+static void
+heap_pool_init (void)
+{
+	unsigned int block;
+
+	heap_pool = heap_alloc(HEAP_POOL_BLOCKS * HEAP_POOL_BLOCK_SIZE);
+	for (block = 0; block < HEAP_POOL_WORDS * 32; block++) {
+		if (!heap_pool || block >= HEAP_POOL_BLOCKS) {
+			heap_pool_map[block >> 5] |= 1U << (block & 0x1F);
+		}
+	}
+}
+
+void *
+heap_pool_alloc (size_t size)
+{
+	unsigned int word, bit, map;
+	unsigned char taken;
+
+	if (size > HEAP_POOL_BLOCK_SIZE) {
+		return 0;
+	}
+	for (word = 0; word < HEAP_POOL_WORDS; word++) {
+		while ((map = ~heap_pool_map[word]) != 0) {
+			/* Someone else may claim the bit first, try again.  */
+			bit = heap_bsf(map);
+			__asm__ volatile("lock btsl %2, %0; setc %1"
+					: "+m"(heap_pool_map[word]), "=q"(taken)
+					: "r"(bit)
+					: "memory", "cc");
+			if (!taken) {
+				return heap_pool + ((word << 5) | bit)
+					* HEAP_POOL_BLOCK_SIZE;
+			}
+		}
+	}
+	return 0;
+}
+
+void
+heap_pool_free (void * ptr)
+{
+	unsigned int block;
+
+	/* Only the exact pointers given by heap_pool_alloc are accepted.  */
+	if ((HEAP_ADDR) ptr < heap_pool
+			|| (HEAP_ADDR) ptr >= heap_pool
+			+ HEAP_POOL_BLOCKS * HEAP_POOL_BLOCK_SIZE
+			|| ((HEAP_ADDR) ptr - heap_pool) % HEAP_POOL_BLOCK_SIZE) {
+		return;
+	}
+	block = ((HEAP_ADDR) ptr - heap_pool) / HEAP_POOL_BLOCK_SIZE;
+	__asm__ volatile("lock btrl %1, %0"
+			: "+m"(heap_pool_map[block >> 5])
+			: "r"(block & 0x1F)
+			: "memory", "cc");
+}
+
 void
 heap_init (void)
 {
@@ -164,104 +698,656 @@ heap_init (void)
 	heap_root->prev = 0;
 	heap_root->next = 0;
 
+	/* At the beginning, the whole heap is a single free region.  */
+	heap_blocks = 1;
+	heap_tail = (heap_block_t *) heap_root;
+	heap_list(heap_tail);
+
 	spinlock_init(&heap_allocator_spinlock);
+	heap_pool_init();
 }
 
-void *
-heap_alloc (size_t size)
+#ifdef HEAPTRACE
+/**
+ * \brief Record an entry in the heap trace ring buffer.
+ *
+ * The heap lock must be held while calling this function.
+ */
+static void
+heaptrace_record (unsigned int op, void * ptr, size_t size, void ** frame)
 {
-	heap_block_t * root, * block, * next_block;
-	HEAP_ADDR blockptr, buffer, after_buffer;
+	struct heaptrace_entry * entry;
+	void ** next;
+	unsigned int i;
 
-	root = (heap_block_t *) heap_root;
-	buffer = 0;
+	entry = &heaptrace_ring[heaptrace_count++ % HEAPTRACE_ENTRIES];
+	entry->op = op;
+	entry->ptr = ptr;
+	entry->size = size;
+	entry->ticks = pctimer_ticks();
 
-	/* Make sure we are the only allocator in the neighbourhood.  */
-	spinlock_lock(&heap_allocator_spinlock);
+	/* Each frame holds the frame of the caller followed by the return
+	 * address.  locore starts the chain with a null frame, and anything
+	 * that does not look like an outer frame of the same stack ends it.  */
+	for (i = 0; i < HEAPTRACE_DEPTH; i++) {
+		if (!frame) {
+			entry->callers[i] = 0;
+			continue;
+		}
+		entry->callers[i] = frame[1];
+		next = (void **) frame[0];
+		if (next <= frame || ((unsigned int) next & 3)
+				|| (unsigned int) next - (unsigned int) frame
+				> HEAPTRACE_FRAME_SPAN) {
+			next = 0;
+		}
+		frame = next;
+	}
+}
+#endif
 
-	for (block = root; block; block = (heap_block_t *) block->next) {
-		blockptr = (HEAP_ADDR) block;
+/**
+ * \brief Shrink an allocated control block to the given size.
+ *
+ * If the data region is big enough to hold the given size and another control
+ * block, the remaining space is turned into a new free control block, which
+ * is merged with the following block if that one is also free.
+ *
+ * \param block the allocated control block to split.
+ * \param size the new size of the data region, already rounded.
+ */
+static void
+heap_split (heap_block_t * block, HEAP_SIZE size)
+{
+	heap_block_t * next_block;
+
+	/* Early return if there is not enough space for split.  */
+	if (block->size < (size + sizeof(heap_block_t) + HEAP_MIN_SIZE)) {
+		return; /* No.  */
+	}
 
-		if (block->magic != HEAP_MAGIC_HEAD) {
-			/* This is not a heap control block!  Ackchyually,
-			 * yeah, nothing guarantees us that this is a rogue
-			 * control block with valid magic numbers.  */
-			goto _cleanup;
+	next_block = (heap_block_t *) ((HEAP_ADDR) block
+		+ sizeof(heap_block_t) + size);
+
+	/* Mark the bounds of the buffer as a new block.  */
+	next_block->magic = HEAP_MAGIC_HEAD;
+	next_block->status = HEAP_MAGIC_FREE;
+	next_block->size = block->size - size - sizeof(heap_block_t);
+	next_block->prev = (HEAP_ADDR) block;
+	next_block->next = block->next;
+	if (block->next) {
+		((heap_block_t *) block->next)->prev = (HEAP_ADDR) next_block;
+	}
+
+	/* Shrink the current block.  */
+	block->size = size;
+	block->next = (HEAP_ADDR) next_block;
+	if (heap_tail == block) {
+		heap_tail = next_block;
+	}
+	heap_blocks++;
+
+	/* The remaining part is available for future allocations.  */
+	heap_list(next_block);
+	if (next_block->next) {
+		heap_merge(next_block, (heap_block_t *) next_block->next);
+	}
+}
+
+/**
+ * \brief Round a size requested by a caller to a valid data region size.
+ * \param size the size requested by the caller.
+ * \return the size of the data region that will hold the given size, or
+ *         zero if the size could never be allocated.
+ */
+static inline HEAP_SIZE
+heap_round (size_t size)
+{
+	if (size > HEAP_MAX_SIZE) {
+		/* Rounding could wrap around.  */
+		return 0;
+	}
+	/* The data region must be able to hold the free list links once it
+	 * is freed, and control blocks should be kept aligned.  */
+	if (size < HEAP_MIN_SIZE) {
+		size = HEAP_MIN_SIZE;
+	}
+	return (size + HEAP_ALIGN - 1) & ~(HEAP_ALIGN - 1);
+}
+
+static unsigned int heap_mag_flush (void);
+
+/**
+ * \brief Locate a free control block, growing the heap if required.
+ * \param size the size of the data region, already rounded.
+ * \return a free control block, or NULL if the heap is exhausted.
+ */
+static heap_block_t *
+heap_obtain (HEAP_SIZE size)
+{
+	heap_block_t * block;
+
+	block = heap_find(size);
+	if (!block && heap_grow(size) == 0) {
+		block = heap_find(size);
+	}
+	if (!block && heap_mag_flush() > 0) {
+		/* Regions kept in the magazines may have been in the way.  */
+		block = heap_find(size);
+		if (!block && heap_grow(size) == 0) {
+			block = heap_find(size);
 		}
+	}
+	if (!block || block->magic != HEAP_MAGIC_HEAD) {
+		/* Either the heap is exhausted, or this is not a heap control
+		 * block.  Ackchyually, yeah, nothing guarantees us that this
+		 * is a rogue control block with valid magic numbers.  */
+		return 0;
+	}
+	return block;
+}
 
-		if (block->status != HEAP_MAGIC_FREE) {
-			/* Block cannot be used because it's allocated.  */
-			continue;
+/**
+ * \brief Get the control block for a buffer handed out by the heap.
+ * \param ptr the buffer returned by the allocator.
+ * \return the control block, or NULL if ptr is not an allocated buffer.
+ */
+static inline heap_block_t *
+heap_block_of (void * ptr)
+{
+	heap_block_t * bufheader;
+
+	if (!ptr) {
+		return 0;
+	}
+
+	/* If this is an allocated buffer, it should have a header.  */
+	bufheader = (heap_block_t *) ((HEAP_ADDR) ptr - sizeof(heap_block_t));
+	if (bufheader->magic != HEAP_MAGIC_HEAD) {
+		/* Hey wait a second!  */
+		return 0;
+	}
+
+	/* It should be used.  */
+	if ((unsigned int) bufheader->status != HEAP_MAGIC_USED) {
+		return 0;
+	}
+	return bufheader;
+}
+
+/**
+ * \brief Allocate a data region of the given size from the global heap.
+ *
+ * The heap lock must be held while calling this function.
+ *
+ * \param size the size of the data region, already rounded.
+ * \return the data region, or NULL if the heap is exhausted.
+ */
+static HEAP_ADDR
+heap_alloc_locked (HEAP_SIZE size)
+{
+	heap_block_t * block;
+
+	if ((block = heap_obtain(size)) == 0) {
+		return 0;
+	}
+
+	/* Okay, so if we are here, we can allocate.  */
+	heap_unlist(block);
+	block->status = HEAP_MAGIC_USED;
+	heap_split(block, size);
+	return (HEAP_ADDR) block + sizeof(heap_block_t);
+}
+
+/**
+ * \brief Give an allocated control block back to the global heap.
+ *
+ * The heap lock must be held while calling this function.
+ *
+ * \param block the allocated control block to free.
+ */
+static void
+heap_free_locked (heap_block_t * block)
+{
+	/* Mark the block as free.  */
+	block->status = HEAP_MAGIC_FREE;
+	heap_list(block);
+
+	/* Test for merge. */
+	if (block->next) {
+		heap_merge(block, (heap_block_t *) block->next);
+	}
+	if (block->prev) {
+		heap_merge((heap_block_t *) block->prev, block);
+	}
+
+	/* Give memory back if the end of the heap window is free.  */
+	heap_trim();
+}
+
+/**
+ * \brief Disable the interrupts, saving whether they were enabled.
+ * \return the value of EFLAGS before disabling the interrupts.
+ */
+static inline unsigned int
+heap_irq_save (void)
+{
+	unsigned int flags;
+	__asm__ volatile("pushfl; popl %0; cli" : "=r"(flags) : : "memory");
+	return flags;
+}
+
+/**
+ * \brief Restore the interrupt flag saved by heap_irq_save.
+ * \param flags the value returned by heap_irq_save.
+ */
+static inline void
+heap_irq_restore (unsigned int flags)
+{
+	__asm__ volatile("pushl %0; popfl" : : "r"(flags) : "memory", "cc");
+}
+
+/**
+ * \brief Get the magazines of the processor running this code.
+ *
+ * Until other processors are brought up, only the boot processor runs kernel
+ * code.  Interrupts must be disabled while the magazines are in use, so that
+ * the code is not moved to a different processor and interrupt handlers do
+ * not modify the magazines.
+ */
+static inline struct heap_cpu *
+heap_cpu (void)
+{
+	return &heap_cpus[0];
+}
+
+#ifndef HEAPTRACE
+/* Tracing records every call, so it bypasses the magazines.  */
+
+/**
+ * \brief Allocate a data region from the magazines of this processor.
+ *
+ * If the magazine for the given size is empty, it is refilled with a batch of
+ * regions allocated from the global heap, so the heap lock is only taken
+ * once per batch.
+ *
+ * \param size the size of the data region, already rounded.
+ * \return the data region, or NULL if it could not be allocated this way.
+ */
+static HEAP_ADDR
+heap_mag_alloc (HEAP_SIZE size)
+{
+	heap_magazine_t * mag;
+	HEAP_ADDR buffer = 0;
+	unsigned int flags;
+
+	if (size > HEAP_MAG_MAX) {
+		return 0;
+	}
+
+	flags = heap_irq_save();
+	mag = &heap_cpu()->mags[(size - 1) / HEAP_MAG_STEP];
+	if (mag->count == 0) {
+		/* Refill the magazine using regions of the size of the bucket,
+		 * so that they can hold any size in the bucket.  */
+		size = ((size - 1) / HEAP_MAG_STEP + 1) * HEAP_MAG_STEP;
+		spinlock_lock(&heap_allocator_spinlock);
+		while (mag->count < HEAP_MAG_BATCH) {
+			if ((buffer = heap_alloc_locked(size)) == 0) {
+				break;
+			}
+			mag->rounds[mag->count++] = buffer;
 		}
+		spinlock_release(&heap_allocator_spinlock);
+	}
+	if (mag->count > 0) {
+		buffer = mag->rounds[--mag->count];
+		heap_cpu()->allocs++;
+	}
+	heap_irq_restore(flags);
 
-		if (block->size < size) {
-			/* Block is not big enough for this allocation.  */
-			continue;
+	return buffer;
+}
+
+/**
+ * \brief Put an allocated control block in the magazines of this processor.
+ *
+ * If the magazine for the size of the block is full, a batch of regions is
+ * given back to the global heap first, so the heap lock is only taken once
+ * per batch.
+ *
+ * \param block the allocated control block to free.
+ * \return non-zero if the block is now in a magazine, zero if the size of the
+ *         block is not handled by the magazines.
+ */
+static int
+heap_mag_free (heap_block_t * block)
+{
+	heap_magazine_t * mag;
+	unsigned int flags;
+
+	if (block->size < HEAP_MAG_STEP
+			|| block->size >= HEAP_MAG_MAX + HEAP_MAG_STEP) {
+		return 0;
+	}
+
+	flags = heap_irq_save();
+	mag = &heap_cpu()->mags[block->size / HEAP_MAG_STEP - 1];
+	if (mag->count == HEAP_MAG_ROUNDS) {
+		spinlock_lock(&heap_allocator_spinlock);
+		while (mag->count > HEAP_MAG_ROUNDS - HEAP_MAG_BATCH) {
+			heap_free_locked((heap_block_t *)
+				(mag->rounds[--mag->count]
+				 - sizeof(heap_block_t)));
 		}
+		spinlock_release(&heap_allocator_spinlock);
+	}
+	mag->rounds[mag->count++] = (HEAP_ADDR) block + sizeof(heap_block_t);
+	heap_cpu()->frees++;
+	heap_irq_restore(flags);
+
+	return 1;
+}
+#endif
 
-		/* Okay, so if we are here, we can allocate.  */
-		block->status = HEAP_MAGIC_USED;
-		buffer = (HEAP_ADDR) (blockptr + sizeof(heap_block_t));
+/**
+ * \brief Give every region in the magazines of this processor back.
+ *
+ * The heap lock must be held while calling this function.
+ *
+ * \return the amount of regions given back to the global heap.
+ */
+static unsigned int
+heap_mag_flush (void)
+{
+	heap_magazine_t * mag;
+	unsigned int flags, bucket, count = 0;
 
-		/* Early return if there is not enough space for split.  */
-		if (block->size <= (size + sizeof(heap_block_t) + 1)) {
-			goto _cleanup; /* No.  */
+	flags = heap_irq_save();
+	for (bucket = 0; bucket < HEAP_MAG_BUCKETS; bucket++) {
+		mag = &heap_cpu()->mags[bucket];
+		while (mag->count > 0) {
+			heap_free_locked((heap_block_t *)
+				(mag->rounds[--mag->count]
+				 - sizeof(heap_block_t)));
+			count++;
 		}
+	}
+	heap_irq_restore(flags);
 
-		after_buffer = (HEAP_ADDR) (buffer + size);
-		next_block = (heap_block_t *) after_buffer;
+	return count;
+}
 
-		/* Mark the bounds of the buffer as a new block.  */
-		next_block->magic = HEAP_MAGIC_HEAD;
-		next_block->status = HEAP_MAGIC_FREE;
-		next_block->size = block->size - size - sizeof(heap_block_t);
-		next_block->prev = (HEAP_ADDR) block;
-		next_block->next = block->next;
+void *
+heap_alloc (size_t size)
+{
+	HEAP_ADDR buffer;
 
-		/* Shrink the current block.  */
-		block->size = size;
-		block->next = (HEAP_ADDR) next_block;
+	if ((size = heap_round(size)) == 0) {
+		return 0;
+	}
 
-		/* No iterations required anymore.  */
-		break;
+#ifndef HEAPTRACE
+	/* Most allocations should not need to take the heap lock.  */
+	if ((buffer = heap_mag_alloc(size)) != 0) {
+		return buffer;
 	}
-_cleanup:
+#endif
+
+	/* Make sure we are the only allocator in the neighbourhood.  */
+	spinlock_lock(&heap_allocator_spinlock);
+
+	if ((buffer = heap_alloc_locked(size)) != 0) {
+		heap_allocs++;
+	} else {
+		heap_failures++;
+	}
+	HEAPTRACE_RECORD(HEAPTRACE_ALLOC, buffer, size);
+
 	/* Make sure to unlock the spinlock or the system will collapse.  */
 	spinlock_release(&heap_allocator_spinlock);
 	return buffer;
 }
 
+void *
+heap_alloc_aligned (size_t size, size_t align)
+{
+	heap_block_t * block, * aligned;
+	HEAP_ADDR data, buffer = 0;
+	HEAP_SIZE gap;
+
+	if (align <= HEAP_ALIGN) {
+		return heap_alloc(size);
+	}
+	if ((align & (align - 1)) || align > HEAP_MAX_SIZE) {
+		/* Alignment must be a power of two that fits in the heap.  */
+		return 0;
+	}
+	if ((size = heap_round(size)) == 0) {
+		return 0;
+	}
+
+	spinlock_lock(&heap_allocator_spinlock);
+
+	/* Worst case, the buffer is found after a whole alignment unit plus
+	 * the room for a free control block in front of it.  */
+	gap = align + sizeof(heap_block_t) + HEAP_MIN_SIZE;
+	if ((block = heap_obtain(size + gap)) == 0) {
+		heap_failures++;
+		goto _cleanup;
+	}
+
+	/* Locate the first aligned address that leaves room for a free
+	 * control block in front of it, unless it is already aligned.  */
+	data = (HEAP_ADDR) block + sizeof(heap_block_t);
+	buffer = (HEAP_ADDR) (((unsigned int) data + align - 1) & ~(align - 1));
+	gap = sizeof(heap_block_t) + HEAP_MIN_SIZE;
+	while (buffer != data && (HEAP_SIZE) (buffer - data) < gap) {
+		buffer += align;
+	}
+
+	heap_unlist(block);
+	if (buffer != data) {
+		/* The space in front of the buffer remains free.  */
+		gap = buffer - data;
+		aligned = (heap_block_t *) (buffer - sizeof(heap_block_t));
+		aligned->magic = HEAP_MAGIC_HEAD;
+		aligned->size = block->size - gap;
+		aligned->prev = (HEAP_ADDR) block;
+		aligned->next = block->next;
+		if (block->next) {
+			((heap_block_t *) block->next)->prev =
+				(HEAP_ADDR) aligned;
+		}
+		block->next = (HEAP_ADDR) aligned;
+		block->size = gap - sizeof(heap_block_t);
+		if (heap_tail == block) {
+			heap_tail = aligned;
+		}
+		heap_blocks++;
+		heap_list(block);
+		block = aligned;
+	}
+	block->status = HEAP_MAGIC_USED;
+	heap_split(block, size);
+	heap_allocs++;
+
+_cleanup:
+	HEAPTRACE_RECORD(HEAPTRACE_ALLOC, buffer, size);
+	spinlock_release(&heap_allocator_spinlock);
+	return buffer;
+}
+
+void *
+heap_realloc (void * ptr, size_t size)
+{
+	heap_block_t * block, * next;
+	HEAP_SIZE available;
+	void * buffer;
+
+	if (!ptr) {
+		return heap_alloc(size);
+	} else if (!size) {
+		heap_free(ptr);
+		return 0;
+	}
+	if ((size = heap_round(size)) == 0) {
+		return 0;
+	}
+
+	spinlock_lock(&heap_allocator_spinlock);
+	if ((block = heap_block_of(ptr)) == 0) {
+		spinlock_release(&heap_allocator_spinlock);
+		return 0;
+	}
+
+	/* If this is the last block, growing the heap puts free space
+	 * right after it, so it can still be resized in place.  */
+	if (block->size < size && block == heap_tail
+			&& (HEAP_ADDR) ptr + block->size == heap_brk) {
+		heap_grow(size - block->size);
+	}
+
+	/* Absorb the following block if it is free and big enough.  */
+	next = (heap_block_t *) block->next;
+	if (block->size < size && next && next->status == HEAP_MAGIC_FREE
+			&& (HEAP_ADDR) next == (HEAP_ADDR) ptr + block->size) {
+		available = block->size + sizeof(heap_block_t) + next->size;
+		if (available >= size) {
+			heap_unlist(next);
+			block->next = next->next;
+			if (next->next) {
+				((heap_block_t *) next->next)->prev =
+					(HEAP_ADDR) block;
+			}
+			if (heap_tail == next) {
+				heap_tail = block;
+			}
+			heap_blocks--;
+			block->size = available;
+		}
+	}
+
+	if (block->size >= size) {
+		/* Give back whatever is not required anymore.  */
+		HEAPTRACE_RECORD(HEAPTRACE_FREE, ptr, block->size);
+		heap_split(block, size);
+		HEAPTRACE_RECORD(HEAPTRACE_ALLOC, ptr, size);
+		spinlock_release(&heap_allocator_spinlock);
+		return ptr;
+	}
+	spinlock_release(&heap_allocator_spinlock);
+
+	/* It has to be moved somewhere else.  */
+	if ((buffer = heap_alloc(size)) != 0) {
+		memcpy(buffer, ptr, block->size);
+		heap_free(ptr);
+	}
+	return buffer;
+}
+
 void
 heap_free (void * ptr)
 {
-	heap_block_t * bufheader, * nextblock, * prevblock;
+	heap_block_t * bufheader;
+
+#ifndef HEAPTRACE
+	/* Most deallocations should not need to take the heap lock.  The
+	 * header of a block in use can only be modified by its owner.  */
+	if ((bufheader = heap_block_of(ptr)) != 0 && heap_mag_free(bufheader)) {
+		return;
+	}
+#endif
 
 	/* Lock before doing anything useful.  */
 	spinlock_lock(&heap_allocator_spinlock);
 
-	/* If this is an allocated buffer, it should have a header.  */
-	bufheader = (heap_block_t *) (ptr - sizeof(heap_block_t));
-	if (bufheader->magic != HEAP_MAGIC_HEAD) {
-		/* Hey wait a second!  */
-		goto _cleanup;
+	if ((bufheader = heap_block_of(ptr)) != 0) {
+		HEAPTRACE_RECORD(HEAPTRACE_FREE, ptr, bufheader->size);
+		heap_frees++;
+		heap_free_locked(bufheader);
 	}
 
-	/* It should be used.  */
-	if (bufheader->status != HEAP_MAGIC_USED) {
-		goto _cleanup;
+	/* Make sure to unlock the spinlock or things will collapse.  */
+	spinlock_release(&heap_allocator_spinlock);
+}
+
+void
+heap_get_stats (struct heap_stats * stats)
+{
+	heap_block_t * block;
+	heap_magazine_t * mags;
+	unsigned int class, cpu, block_idx;
+
+	spinlock_lock(&heap_allocator_spinlock);
+
+	stats->total_bytes = (HEAP_SIZE) (&heap_top - &heap_bottom)
+		+ (HEAP_SIZE) (heap_brk - (HEAP_ADDR) HEAP_WINDOW_START);
+	stats->free_bytes = heap_free_bytes;
+	stats->used_bytes = stats->total_bytes - heap_free_bytes
+		- heap_blocks * sizeof(heap_block_t);
+	stats->blocks = heap_blocks;
+	stats->free_blocks = 0;
+	for (class = 0; class < HEAP_CLASSES; class++) {
+		stats->classes[class] = heap_free_count[class];
+		stats->free_blocks += heap_free_count[class];
 	}
 
-	/* Mark the block as free.  */
-	bufheader->status = HEAP_MAGIC_FREE;
+	/* The largest free block lives in the highest class in use.  */
+	stats->largest_free = 0;
+	if (heap_classes_map) {
+		class = heap_bsr(heap_classes_map);
+		for (block = heap_free_lists[class]; block;
+				block = HEAP_LINKS(block)->fnext) {
+			if (block->size > stats->largest_free) {
+				stats->largest_free = block->size;
+			}
+		}
+	}
 
-	/* Test for merge. */
-	if (bufheader->next) {
-		heap_merge(bufheader, (heap_block_t *) bufheader->next);
+	stats->allocs = heap_allocs;
+	stats->frees = heap_frees;
+	stats->failures = heap_failures;
+	stats->pool_blocks = heap_pool ? HEAP_POOL_BLOCKS : 0;
+	stats->pool_used = 0;
+	for (block_idx = 0; block_idx < stats->pool_blocks; block_idx++) {
+		if (heap_pool_map[block_idx >> 5] & (1U << (block_idx & 0x1F))) {
+			stats->pool_used++;
+		}
 	}
-	if (bufheader->prev) {
-		heap_merge((heap_block_t *) bufheader->prev, bufheader);
+	stats->cached_blocks = 0;
+	for (cpu = 0; cpu < HEAP_CPUS; cpu++) {
+		mags = heap_cpus[cpu].mags;
+		stats->allocs += heap_cpus[cpu].allocs;
+		stats->frees += heap_cpus[cpu].frees;
+		for (class = 0; class < HEAP_MAG_BUCKETS; class++) {
+			stats->cached_blocks += mags[class].count;
+		}
 	}
-_cleanup:
-	/* Make sure to unlock the spinlock or things will collapse.  */
+
+	spinlock_release(&heap_allocator_spinlock);
+}
+
+#ifdef HEAPTRACE
+unsigned int
+heaptrace_read (struct heaptrace_entry * entries, unsigned int count)
+{
+	unsigned int first, i;
+
+	spinlock_lock(&heap_allocator_spinlock);
+
+	if (count > heaptrace_count) {
+		count = heaptrace_count;
+	}
+	if (count > HEAPTRACE_ENTRIES) {
+		count = HEAPTRACE_ENTRIES;
+	}
+	first = heaptrace_count - count;
+	for (i = 0; i < count; i++) {
+		entries[i] = heaptrace_ring[(first + i) % HEAPTRACE_ENTRIES];
+	}
+
 	spinlock_release(&heap_allocator_spinlock);
+	return count;
 }
+#endif
@@ -0,0 +1,250 @@
+/*
+ * This file is part of NativeOS
+ * Copyright (C) 2015-2022 The NativeOS contributors
+ * SPDX-License-Identifier:  GPL-3.0-only
+ */
+
+/**
+ * \file kmem.c
+ * \brief i386 implementation of the kernel object caches
+ *
+ * Every slab is a 4 KB page frame requested to the physical memory manager.
+ * The first bytes of the page are used by the slab header, and the rest of
+ * the page is split in objects.  Because slabs are aligned to the page size,
+ * the slab an object belongs to can be found by just masking the address of
+ * the object, so objects don't need any header of their own.
+ *
+ * Free objects inside a slab are linked in a free list.  The link is stored
+ * in the first bytes of the free object, so objects must be at least as big
+ * as a pointer.
+ *
+ * Each cache keeps its slabs in three lists: partial slabs (some objects are
+ * free), full slabs (no objects are free) and empty slabs (every object is
+ * free).  Allocations are always served from partial slabs first, so that
+ * slabs fill up and empty slabs can be given back to the physical memory
+ * manager.  A single empty slab is kept per cache to avoid requesting and
+ * releasing a page frame when a single object is repeatedly allocated and
+ * freed.
+ */
+
+#include <kernel/mem/pmm.h>
+#include <sys/kmem.h>
+#include <sys/spinlock.h>
+#include <sys/stdkern.h>
+
+/** Size of a slab.  It must be equal to the size of a page frame.  */
+#define KMEM_SLAB_SIZE 0x1000
+
+/** Magic number that indicates that a slab header follows.  */
+#define KMEM_SLAB_MAGIC 0x51AB51AB
+
+/** Objects are always a multiple of this amount of bytes.  */
+#define KMEM_ALIGN sizeof(void *)
+
+/** Get the slab that holds the given object.  */
+#define KMEM_SLAB_OF(obj) \
+	((struct kmem_slab *) ((unsigned int) (obj) & ~(KMEM_SLAB_SIZE - 1)))
+
+/**
+ * \brief Slab header
+ *
+ * The slab header is placed at the beginning of each page frame used as a
+ * slab, and it keeps track of the objects that are free in this slab.
+ */
+struct kmem_slab {
+	unsigned int magic;
+	struct kmem_cache *cache;
+	struct kmem_slab *next, *prev;
+	void *freelist;
+	unsigned int inuse;
+};
+
+struct kmem_cache {
+	const char *name;
+	size_t objsize;
+	unsigned int perslab;
+	kmem_ctor_t ctor;
+	struct kmem_slab *partial, *full, *empty;
+	struct spinlock lock;
+};
+
+static inline void
+slab_link(struct kmem_slab **list, struct kmem_slab *slab)
+{
+	slab->prev = 0;
+	slab->next = *list;
+	if (*list) {
+		(*list)->prev = slab;
+	}
+	*list = slab;
+}
+
+static inline void
+slab_unlink(struct kmem_slab **list, struct kmem_slab *slab)
+{
+	if (slab->prev) {
+		slab->prev->next = slab->next;
+	} else {
+		*list = slab->next;
+	}
+	if (slab->next) {
+		slab->next->prev = slab->prev;
+	}
+	slab->next = 0;
+	slab->prev = 0;
+}
+
+/**
+ * \brief Request a page frame and turn it into a slab for a cache.
+ * \param cache the cache that will own the new slab.
+ * \return the new slab, or NULL if no page frames are available.
+ */
+static struct kmem_slab *
+slab_create(struct kmem_cache *cache)
+{
+	struct kmem_slab *slab;
+	unsigned char *obj;
+	unsigned int i;
+
+	slab = (struct kmem_slab *) (unsigned int) pmm_alloc_page(
+	    PMM_ZONE_NORMAL, PMM_OWNER_SLAB);
+	if (slab == 0) {
+		return 0;
+	}
+
+	slab->magic = KMEM_SLAB_MAGIC;
+	slab->cache = cache;
+	slab->next = 0;
+	slab->prev = 0;
+	slab->inuse = 0;
+
+	/* Chain every object in the slab to the free list.  */
+	obj = (unsigned char *) (slab + 1);
+	slab->freelist = obj;
+	for (i = 1; i < cache->perslab; i++, obj += cache->objsize) {
+		*(void **) obj = obj + cache->objsize;
+	}
+	*(void **) obj = 0;
+
+	return slab;
+}
+
+static void
+slab_destroy(struct kmem_slab *slab)
+{
+	slab->magic = 0;
+	pmm_free_page((unsigned int) slab);
+}
+
+kmem_cache_t *
+kmem_cache_create(const char *name, size_t size, kmem_ctor_t ctor)
+{
+	kmem_cache_t *cache;
+
+	if (size < sizeof(void *)) {
+		size = sizeof(void *);
+	}
+	size = (size + KMEM_ALIGN - 1) & ~(KMEM_ALIGN - 1);
+	if (size > KMEM_SLAB_SIZE - sizeof(struct kmem_slab)) {
+		/* Doesn't fit in a slab.  */
+		return 0;
+	}
+
+	if ((cache = (kmem_cache_t *) malloc(sizeof(kmem_cache_t))) != 0) {
+		cache->name = name;
+		cache->objsize = size;
+		cache->perslab = (KMEM_SLAB_SIZE - sizeof(struct kmem_slab)) / size;
+		cache->ctor = ctor;
+		cache->partial = 0;
+		cache->full = 0;
+		cache->empty = 0;
+		spinlock_init(&cache->lock);
+	}
+	return cache;
+}
+
+void *
+kmem_cache_alloc(kmem_cache_t *cache)
+{
+	struct kmem_slab *slab;
+	void *obj = 0;
+
+	spinlock_lock(&cache->lock);
+
+	/* Pick the slab to allocate from, preferring partial slabs.  */
+	if ((slab = cache->partial) == 0) {
+		if ((slab = cache->empty) != 0) {
+			slab_unlink(&cache->empty, slab);
+		} else if ((slab = slab_create(cache)) == 0) {
+			goto _cleanup;
+		}
+		slab_link(&cache->partial, slab);
+	}
+
+	obj = slab->freelist;
+	slab->freelist = *(void **) obj;
+	if (++slab->inuse == cache->perslab) {
+		slab_unlink(&cache->partial, slab);
+		slab_link(&cache->full, slab);
+	}
+_cleanup:
+	spinlock_release(&cache->lock);
+
+	if (obj && cache->ctor) {
+		cache->ctor(obj);
+	}
+	return obj;
+}
+
+void
+kmem_cache_free(kmem_cache_t *cache, void *obj)
+{
+	struct kmem_slab *slab = KMEM_SLAB_OF(obj);
+
+	if (!obj || slab->magic != KMEM_SLAB_MAGIC || slab->cache != cache) {
+		/* Not an object handed out by this cache.  */
+		return;
+	}
+
+	spinlock_lock(&cache->lock);
+
+	*(void **) obj = slab->freelist;
+	slab->freelist = obj;
+	if (slab->inuse-- == cache->perslab) {
+		slab_unlink(&cache->full, slab);
+		slab_link(&cache->partial, slab);
+	}
+	if (slab->inuse == 0) {
+		slab_unlink(&cache->partial, slab);
+		if (cache->empty) {
+			/* One empty slab is enough, give this one back.  */
+			slab_destroy(slab);
+		} else {
+			slab_link(&cache->empty, slab);
+		}
+	}
+
+	spinlock_release(&cache->lock);
+}
+
+static void
+slab_destroy_list(struct kmem_slab *list)
+{
+	struct kmem_slab *next;
+	while (list) {
+		next = list->next;
+		slab_destroy(list);
+		list = next;
+	}
+}
+
+void
+kmem_cache_destroy(kmem_cache_t *cache)
+{
+	if (cache) {
+		slab_destroy_list(cache->partial);
+		slab_destroy_list(cache->full);
+		slab_destroy_list(cache->empty);
+		free(cache);
+	}
+}
@@ -0,0 +1,136 @@
+/*
+ * This file is part of NativeOS
+ * Copyright (C) 2015-2022 The NativeOS contributors
+ * SPDX-License-Identifier:  GPL-3.0-only
+ */
+
+/**
+ * \file kstack.c
+ * \brief i386 implementation of the kernel stacks
+ *
+ * A kernel stack is a vmalloc range, so the guard page below it comes for
+ * free.  Painting the stack also touches every page of the range, so every
+ * page is mapped before the stack is used.
+ *
+ * An overflow writes into the guard page, and the page fault cannot be
+ * pushed on the same stack, so the processor raises a double fault instead.
+ * The double fault is handled by a task with its own stack (see tss.c).
+ */
+
+#include <config.h>
+#include <kernel/mem/heap.h>
+#include <kernel/mem/kstack.h>
+#include <kernel/mem/vmalloc.h>
+#include <machine/paging.h>
+#include <sys/spinlock.h>
+
+#ifndef KERNEL_STACK_SIZE
+#define KERNEL_STACK_SIZE 0x4000
+#endif
+
+/** Pattern written on every word of a stack that was never used.  */
+#define KSTACK_PAINT 0x57AC57AC
+
+struct kstack {
+	const char *name;
+	unsigned int *base;
+	unsigned int size;
+	struct kstack *next;
+};
+
+extern void kernel_die(void);
+
+/* Every kernel stack, most recent first.  */
+static struct kstack *kstack_list;
+
+static struct spinlock kstack_lock;
+
+kstack_t *
+kstack_create(const char *name, size_t size)
+{
+	struct kstack *stack;
+	unsigned int i;
+
+	size = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+	if ((stack = heap_alloc(sizeof(struct kstack))) == 0) {
+		return 0;
+	}
+	if ((stack->base = vmalloc(size)) == 0) {
+		heap_free(stack);
+		return 0;
+	}
+	stack->name = name;
+	stack->size = size;
+
+	/* This also maps every page of the stack.  */
+	for (i = 0; i < size / sizeof(unsigned int); i++) {
+		stack->base[i] = KSTACK_PAINT;
+	}
+
+	spinlock_lock(&kstack_lock);
+	stack->next = kstack_list;
+	kstack_list = stack;
+	spinlock_release(&kstack_lock);
+	return stack;
+}
+
+unsigned int
+kstack_top(kstack_t *stack)
+{
+	return (unsigned int) stack->base + stack->size;
+}
+
+void
+kstack_destroy(kstack_t *stack)
+{
+	struct kstack **link;
+
+	spinlock_lock(&kstack_lock);
+	for (link = &kstack_list; *link; link = &(*link)->next) {
+		if (*link == stack) {
+			*link = stack->next;
+			break;
+		}
+	}
+	spinlock_release(&kstack_lock);
+
+	vfree(stack->base);
+	heap_free(stack);
+}
+
+unsigned int
+kstack_report(struct kstack_info *info, unsigned int count)
+{
+	struct kstack *stack;
+	unsigned int filled = 0, word, words;
+
+	spinlock_lock(&kstack_lock);
+	for (stack = kstack_list; stack && filled < count;
+	     stack = stack->next) {
+		words = stack->size / sizeof(unsigned int);
+		for (word = 0; word < words; word++) {
+			if (stack->base[word] != KSTACK_PAINT) {
+				break;
+			}
+		}
+		info[filled].name = stack->name;
+		info[filled].size = stack->size;
+		info[filled].used = (words - word) * sizeof(unsigned int);
+		filled++;
+	}
+	spinlock_release(&kstack_lock);
+	return filled;
+}
+
+unsigned int
+kstack_init(void)
+{
+	kstack_t *stack;
+
+	kstack_list = 0;
+	spinlock_init(&kstack_lock);
+	if ((stack = kstack_create("kernel", KERNEL_STACK_SIZE)) == 0) {
+		kernel_die();
+	}
+	return kstack_top(stack);
+}
@@ -27,11 +27,62 @@
  * The virtual memory manager depends on the physical memory manager in order
  * to allocate physical memory pages that will be put in the frames in use by
  * the virtual memory address range.
+ *
+ * Free frames are managed by a binary buddy allocator.  Free memory is split
+ * in blocks of 2^order contiguous frames, where each block is aligned to its
+ * own size.  There is a free list per order.  When a block of a given order
+ * is requested and the list for that order is empty, a block of the next
+ * order is split in two halves (two buddies), one of them is handed out and
+ * the other one is put in the free list.  When a block is freed, if its buddy
+ * is also free, both are merged back into a block of the next order, and the
+ * process repeats.  Both operations take O(log n) steps.
+ *
+ * The header of each free block (list links and order) is stored in the
+ * first frame of the free block itself, so the allocator doesn't use any
+ * additional memory.  The frame allocation bitmap is still kept, because it
+ * tells whether a frame is in use; it is used to know whether the buddy of a
+ * block is free.
+ *
+ * In order to find free frames in the bitmap without scanning it word by
+ * word, two summary levels are kept on top of it.  Bit i of the first level
+ * is set when word i of the bitmap is full, and bit j of the second level is
+ * set when word j of the first level is full.  Looking for a free frame
+ * only requires a few bsf instructions, no matter how much memory is used.
+ * The searches only happen during boot, while the free lists are seeded, so
+ * the summary levels are dropped afterwards and allocating or freeing a
+ * frame only touches the bitmap.
+ *
+ * Memory is split in two zones: the DMA zone, which is the memory below
+ * 16 MB that ISA devices can reach, and the normal zone, which is the rest.
+ * Each zone has its own free lists.  Since 16 MB is a multiple of the size
+ * of the biggest block, a block never spans both zones, and two buddies are
+ * always in the same zone.  Allocations prefer the normal zone and only take
+ * memory from the DMA zone when the normal zone is exhausted or when the
+ * caller needs memory that ISA devices can reach.
+ *
+ * Every frame also has a descriptor in the page frame database, which keeps
+ * a reference count and the owner of the frame.  The database is carved out
+ * of free memory during boot, because it may be too big for the early heap.
+ *
+ * A few frames of the normal zone are kept zeroed in advance, so that
+ * pmm_alloc_zeroed_page doesn't need to clear the frame while the caller
+ * waits.  The pool is refilled by pmm_refill_zeroed when the system is
+ * idle, and it is given back to the free lists if memory runs out.
+ *
+ * Memory past the end of the direct map is the highmem zone.  The kernel
+ * cannot write buddy headers into these frames, so they are tracked by a
+ * separate plain bitmap and handed out one at a time, for callers that map
+ * them somewhere else, such as vmalloc.  The size of the memory is taken
+ * from the multiboot memory map, so the memory above the holes under 4 GB
+ * and, when the kernel is built with PAE, the memory above 4 GB are used.
  */
 
 #include <kernel/mem/heap.h>
 #include <kernel/mem/pmm.h>
 #include <machine/multiboot.h>
+#include <machine/paging.h>
+#include <sys/spinlock.h>
+#include <sys/stdkern.h>
 
 /**
  * \brief Frame index.
@@ -42,12 +93,22 @@
  */
 typedef unsigned int frame_idx_t;
 
+#ifdef PAE
+/* Memory above 64 GB is ignored, since that is the limit of most PAE
+ * processors and the page frame database has to fit below the direct map. */
+#define PMM_MEMORY_LIMIT 0x1000000000ULL
+#else
+#define PMM_MEMORY_LIMIT 0x100000000ULL
+#endif
+
+extern void kernel_die(void);
+
 /**
  * \brief Frame allocation bitmap
  *
  * Each bit of this bitmap represents one of the 4 KB frames the memory is
  * split by.  Bit i is set to 1 when frame i, spanning memory addresses
- * (i * 0x4000) up to (i * 0x4000 + 0x3FFF) is already taken.
+ * (i * 0x1000) up to (i * 0x1000 + 0xFFF) is already taken.
  */
 static unsigned int * frames_map;
 
@@ -55,24 +116,156 @@ static unsigned int * frames_map;
  * \brief Number of allocatable frames
  *
  * This is the length of the bitmap phys_frame_bitmap.  So, this variable will
- * hold the total amount of frames that exist in the memory of this machine.
- * Up to 2^20 frames can exist on a machine fully loaded with 4 GB of RAM.
- * For a system with less than 4 GB of RAM, less frames will exist.
+ * hold the total amount of frames that exist in the memory of this machine,
+ * up to the end of the direct map.  Frames past the direct map are counted
+ * in high_count instead.
  */
 static frame_idx_t frames_count;
 
-#define FRAME_NUMBER(memaddr) (memaddr >> 12) /* divide by 4096 */
-#define PHYSICAL_ADDR(idx) (idx << 12) /* multiply by 4096 */
+/**
+ * \brief Highmem bitmap
+ *
+ * Bit i is set when frame (frames_count + i) is taken or is not available.
+ * There are high_count frames in highmem, and every word of the bitmap
+ * below high_hint is full.  The bitmap is carved out of free memory along
+ * with the page frame database.
+ */
+static unsigned int * high_map;
+static frame_idx_t high_count;
+static unsigned int high_hint;
+
+/* End of the last available memory region, while it is being computed.  */
+static unsigned long long memory_end;
+
+/**
+ * \brief Summary levels of the frame allocation bitmap
+ *
+ * Bit i of frames_full is set when word i of frames_map is full.  Bit i of
+ * frames_full2 is set when word i of frames_full is full.  Bits past the end
+ * of each level are always set, so that they never look free.  They are
+ * NULL once the free lists have been seeded.
+ */
+static unsigned int * frames_full;
+static unsigned int * frames_full2;
+
+/**
+ * \brief Search hint
+ *
+ * Every word of frames_map below this one is known to be full, so searches
+ * for a free frame can start here.
+ */
+static unsigned int frames_hint;
+
+#define FRAME_NUMBER(memaddr) ((memaddr) >> 12) /* divide by 4096 */
+#define PHYSICAL_ADDR(idx) ((physaddr_t) (idx) << 12) /* multiply by 4096 */
+
+/** Pointer to a frame below the end of the direct map.  */
+#define FRAME_POINTER(idx) ((void *) ((idx) << 12))
+
+#define BIT_INDEX(frame_idx) ((frame_idx) >> 5) /* divide by 32 */
+#define BIT_OFFSET(frame_idx) ((frame_idx) & 0x1F) /* modulus 32 */
+
+#define OFFSET_MASK(bit) (((unsigned int) 0x1) << (bit))
+
+/** First frame of the normal zone.  Frames below this one are DMA memory.  */
+#define ZONE_NORMAL_START FRAME_NUMBER(0x1000000)
 
-#define BIT_INDEX(frame_idx) (frame_idx >> 5) /* divide by 32 */
-#define BIT_OFFSET(frame_idx) (frame_idx & 0x1F) /* modulus 32 */
+/** Get the zone a frame belongs to.  */
+#define FRAME_ZONE(idx) \
+	((idx) < ZONE_NORMAL_START ? PMM_ZONE_DMA \
+	: (idx) < frames_count ? PMM_ZONE_NORMAL : PMM_ZONE_HIGH)
 
-#define OFFSET_MASK(bit) (((unsigned int) 0x1) << bit)
+/** Magic number that identifies the header of a free block.  */
+#define BUDDY_MAGIC 0xB0DDB0DD
+
+/** Get the header of the free block that starts at the given frame.  */
+#define BUDDY_BLOCK(idx) ((buddy_block_t *) FRAME_POINTER(idx))
+
+/**
+ * \brief Free block header
+ *
+ * This header is placed in the first frame of every block that is in a free
+ * list.  The magic number is cleared when the block stops being free or
+ * when it is merged into a bigger block.
+ */
+typedef struct buddy_block {
+	unsigned int magic;
+	unsigned int order;
+	struct buddy_block * next;
+	struct buddy_block * prev;
+} buddy_block_t;
+
+/* Free lists, one per zone and order.  */
+static buddy_block_t * buddy_lists[PMM_ZONES][PMM_ORDERS];
+
+/**
+ * \brief Page frame database
+ *
+ * Descriptor i describes frame i.  It is NULL until the database has been
+ * carved out of free memory.
+ */
+static struct pmm_frame * frames_db;
+
+/* Frames managed by each zone, and how many of them are free.  */
+static frame_idx_t zone_total[PMM_ZONES];
+static frame_idx_t zone_free[PMM_ZONES];
+
+/** Amount of frames kept zeroed in advance.  */
+#define ZEROED_MAX 32
+
+/* Frames known to be full of zeros, taken out of the free lists.  */
+static frame_idx_t zeroed_frames[ZEROED_MAX];
+static unsigned int zeroed_count;
+
+static struct spinlock pmm_lock;
+
+/**
+ * \brief Get the index of the least significant bit set.
+ * \param map the value to scan, it must not be zero.
+ * \return the index of the least significant bit set in map.
+ */
+static inline unsigned int
+frame_bsf (unsigned int map)
+{
+	unsigned int index;
+	__asm__("bsfl %1, %0" : "=r"(index) : "rm"(map));
+	return index;
+}
+
+/**
+ * \brief Refresh the summary levels after a word of the bitmap changed.
+ * \param word the index of the word of frames_map that changed.
+ */
+static inline void
+frames_summarize (unsigned int word)
+{
+	unsigned int level1 = BIT_INDEX(word), level2 = BIT_INDEX(level1);
+
+	if (!frames_full) {
+		/* Nothing searches the bitmap after boot.  */
+		return;
+	}
+	if (frames_map[word] == ~0U) {
+		frames_full[level1] |= OFFSET_MASK(BIT_OFFSET(word));
+	} else {
+		frames_full[level1] &= ~OFFSET_MASK(BIT_OFFSET(word));
+		if (word < frames_hint) {
+			frames_hint = word;
+		}
+	}
+
+	if (frames_full[level1] == ~0U) {
+		frames_full2[level2] |= OFFSET_MASK(BIT_OFFSET(level1));
+	} else {
+		frames_full2[level2] &= ~OFFSET_MASK(BIT_OFFSET(level1));
+	}
+}
 
 static inline void
 frame_set (frame_idx_t idx)
 {
 	frames_map[BIT_INDEX(idx)] |= OFFSET_MASK(BIT_OFFSET(idx));
+	frames_summarize(BIT_INDEX(idx));
 }
 
 static inline unsigned int
@@ -85,100 +278,410 @@ static inline void
 frame_clear (frame_idx_t idx)
 {
 	frames_map[BIT_INDEX(idx)] &= ~OFFSET_MASK(BIT_OFFSET(idx));
+	frames_summarize(BIT_INDEX(idx));
 }
 
 /**
- * \brief Return the index of a free frame.
+ * \brief Return the index of the first free frame at or after a frame.
  *
- * Note that this implementation can be improved, because it will take more
- * time to allocate frames as the system grows the in use memory.  However,
- * this is a simple implementation that will make things kick in the meantime.
+ * The summary levels are used to skip full words of the bitmap, so the
+ * search takes a few steps regardless of the amount of memory.  It can only
+ * be used during boot, until the summary levels are dropped.
  *
+ * \param from the frame to start the search at.
  * \return either -1 if no free frames are found, or the frame index otherwise.
  */
 static frame_idx_t
-frame_find_free ()
+frame_find_free (frame_idx_t from)
 {
-	frame_idx_t idx, offset;
-	unsigned int map;
+	unsigned int words, word, level1, level2, map;
+	frame_idx_t found = -1;
+	int hinted = 0;
 
-	for (idx = 0; idx < frames_count; idx += 32) {
-		if (frames_map[BIT_INDEX(idx)] != (unsigned int) -1) {
-			map = frames_map[BIT_INDEX(idx)];
-			for (offset = 0; offset < 32; offset++) {
-				if (!(map & OFFSET_MASK(BIT_OFFSET(offset)))) {
-					return idx | offset;
-				}
+	if (from >= frames_count) {
+		return -1;
+	}
+	if (from <= frames_hint << 5) {
+		/* Skip the words that are known to be full.  */
+		from = frames_hint << 5;
+		hinted = 1;
+	}
+	words = BIT_INDEX(frames_count - 1) + 1;
+
+	/* Try in the word that holds the starting frame.  */
+	word = BIT_INDEX(from);
+	if (word >= words) {
+		goto _done;
+	}
+	map = ~frames_map[word] & (~0U << BIT_OFFSET(from));
+	if (map) {
+		found = (word << 5) | frame_bsf(map);
+		goto _done;
+	}
+
+	/* Try in the words summarized by the same word of the first level.  */
+	if (++word >= words) {
+		goto _done;
+	}
+	level1 = BIT_INDEX(word);
+	map = ~frames_full[level1] & (~0U << BIT_OFFSET(word));
+	if (!map) {
+		/* Find the next word of the first level that is not full.  */
+		if (++level1 > BIT_INDEX(words - 1)) {
+			goto _done;
+		}
+		level2 = BIT_INDEX(level1);
+		map = ~frames_full2[level2] & (~0U << BIT_OFFSET(level1));
+		while (!map) {
+			if (++level2 > BIT_INDEX(BIT_INDEX(words - 1))) {
+				goto _done;
 			}
+			map = ~frames_full2[level2];
 		}
+		level1 = (level2 << 5) | frame_bsf(map);
+		map = ~frames_full[level1];
 	}
+	word = (level1 << 5) | frame_bsf(map);
+	found = (word << 5) | frame_bsf(~frames_map[word]);
 
-	return -1;
+_done:
+	if (hinted) {
+		/* Every word before the one found is full.  */
+		frames_hint = found < frames_count ? BIT_INDEX(found) : words;
+	}
+	return found;
 }
 
+/**
+ * \brief Set or clear the bits for a range of frames.
+ *
+ * Whole words of the bitmap are written at once when possible, since blocks
+ * of order 5 and above always span whole words.
+ *
+ * \param idx the first frame of the range.
+ * \param count the number of frames in the range.
+ * \param used non-zero to mark the frames in use, zero to mark them free.
+ */
 static void
-allocate_frames ()
+frames_mark (frame_idx_t idx, frame_idx_t count, int used)
 {
-	/* mem_upper contains the size of the extended memory area.  Note that
-	 * because multiboot respects the original IBM PC memory map, the
-	 * extended memory starts at 1 MB, so I have to add 1024 kB to whatever
-	 * I have here.  Also note that this variable is expressed in kBs.  */
-	unsigned int mapsize, memsize = (multiboot_info->mem_upper + 1) << 10;
+	frame_idx_t end = idx + count;
 
-	frames_count = FRAME_NUMBER(memsize);
+	while (idx < end) {
+		if (BIT_OFFSET(idx) == 0 && end - idx >= 32) {
+			frames_map[BIT_INDEX(idx)] = used ? ~0U : 0;
+			frames_summarize(BIT_INDEX(idx));
+			idx += 32;
+		} else {
+			if (used) {
+				frame_set(idx);
+			} else {
+				frame_clear(idx);
+			}
+			idx++;
+		}
+	}
+}
 
-	mapsize = BIT_INDEX(frames_count);
-	if (BIT_OFFSET(frames_count) != 0) {
-		mapsize++;
+static inline unsigned int
+high_test (frame_idx_t idx)
+{
+	idx -= frames_count;
+	return high_map[BIT_INDEX(idx)] & OFFSET_MASK(BIT_OFFSET(idx));
+}
+
+static inline void
+high_clear (frame_idx_t idx)
+{
+	idx -= frames_count;
+	high_map[BIT_INDEX(idx)] &= ~OFFSET_MASK(BIT_OFFSET(idx));
+	if (BIT_INDEX(idx) < high_hint) {
+		high_hint = BIT_INDEX(idx);
 	}
-	frames_map = (unsigned int *) heap_alloc(mapsize);
 }
 
 /**
- * \brief Mark frames in use for a specific memory block.
- * \param mblock a memory region declared by multiboot as in use.
+ * \brief Take the first free frame of the highmem bitmap.
+ * \return the frame, or 0 if every highmem frame is in use.
+ */
+static frame_idx_t
+high_take ()
+{
+	unsigned int words = BIT_INDEX(high_count + 31), bit;
+
+	for (; high_hint < words; high_hint++) {
+		/* Bits past the last frame are always set.  */
+		if (high_map[high_hint] != ~0U) {
+			bit = frame_bsf(~high_map[high_hint]);
+			high_map[high_hint] |= OFFSET_MASK(bit);
+			return frames_count + (high_hint << 5) + bit;
+		}
+	}
+	return 0;
+}
+
+/** Test whether a frame of any zone is in use.  */
+static inline unsigned int
+frame_used (frame_idx_t idx)
+{
+	return idx < frames_count ? frame_test(idx) : high_test(idx);
+}
+
+static inline void
+buddy_link (frame_idx_t idx, unsigned int order)
+{
+	buddy_block_t * block = BUDDY_BLOCK(idx);
+
+	block->magic = BUDDY_MAGIC;
+	block->order = order;
+	block->prev = 0;
+	block->next = buddy_lists[FRAME_ZONE(idx)][order];
+	if (block->next) {
+		block->next->prev = block;
+	}
+	buddy_lists[FRAME_ZONE(idx)][order] = block;
+}
+
+static inline void
+buddy_unlink (buddy_block_t * block)
+{
+	unsigned int zone = FRAME_ZONE(FRAME_NUMBER((unsigned int) block));
+
+	if (block->prev) {
+		block->prev->next = block->next;
+	} else {
+		buddy_lists[zone][block->order] = block->next;
+	}
+	if (block->next) {
+		block->next->prev = block->prev;
+	}
+	block->magic = 0;
+}
+
+/**
+ * \brief Test whether a block is free and in the free list for an order.
+ *
+ * A frame that is marked as free in the bitmap is always the first frame of
+ * a free block if it is aligned to the given order, because blocks are always
+ * aligned to their size.  The order in the header still has to be checked,
+ * because the free block may be smaller than requested.
+ */
+static inline int
+buddy_is_free (frame_idx_t idx, unsigned int order)
+{
+	buddy_block_t * block;
+
+	if (idx + (1 << order) > frames_count || frame_test(idx)) {
+		return 0;
+	}
+	block = BUDDY_BLOCK(idx);
+	return block->magic == BUDDY_MAGIC && block->order == order;
+}
+
+/**
+ * \brief Put a block in the free lists, merging it with its buddies.
+ * \param idx the first frame of the block.
+ * \param order the order of the block.
  */
 static void
-reserve_system_block (multiboot_mmap_t * mblock)
+buddy_insert (frame_idx_t idx, unsigned int order)
 {
-	physaddr_t page;
-	unsigned int f, frame_offset = FRAME_NUMBER(mblock->base_addr);
+	frame_idx_t buddy;
 
-	for (f = frame_offset, page = 0;
-			f < frames_count && page < mblock->length;
-			f++, page += 0x1000) {
-		frame_set(f);
+	while (order < PMM_ORDERS - 1) {
+		buddy = idx ^ (1 << order);
+		if (!buddy_is_free(buddy, order)) {
+			break;
+		}
+		buddy_unlink(BUDDY_BLOCK(buddy));
+		if (buddy < idx) {
+			idx = buddy;
+		}
+		order++;
 	}
+	buddy_link(idx, order);
 }
 
 /**
- * \brief Mark frames in use by the system as in use.
+ * \brief Call a function for every memory region available to the system.
+ *
+ * Multiboot reports which memory areas can be used and which memory areas are
+ * reserved (hardware mappings, ACPI tables, or damaged memory regions).  If
+ * the memory map is not present, the extended memory area is assumed to be
+ * the only available memory region.
  *
- * Multiboot may report that some memory areas are reserved (hardware mappings,
- * ACPI tables, or damaged memory regions).  In such cases, it may be desired
- * to mark such frames as permanently in use so that no further pages are
- * allocated into these frames.
+ * \param fn the function to call with the base and length of each region.
  */
 static void
-reserve_system ()
+memory_foreach (void (*fn)(unsigned long long, unsigned long long))
 {
 	multiboot_mmap_t * mblock;
-	physaddr_t mmap_end;
+	unsigned int mmap_end;
 
 	if (multiboot_info->flags & 0x40) {
 		mblock = (multiboot_mmap_t *) multiboot_info->mmap_addr;
-		mmap_end = (physaddr_t) mblock + multiboot_info->mmap_length;
+		mmap_end = (unsigned int) mblock + multiboot_info->mmap_length;
 
-		while ((physaddr_t) mblock < mmap_end) {
-			/* If the block is reserved, mark the pages. */
-			if (mblock->type != 1) {
-				reserve_system_block(mblock);
+		while ((unsigned int) mblock < mmap_end) {
+			if (mblock->type == 1) {
+				fn(mblock->base_addr, mblock->length);
 			}
 
 			/* Skips to the next block (forgive weird math). */
 			mblock = (multiboot_mmap_t *) ((unsigned int) mblock +
 				mblock->size + sizeof(mblock->size));
 		}
+	} else {
+		/* mem_upper contains the size in kB of the extended memory
+		 * area, which starts at 1 MB.  */
+		fn(0x100000,
+		    (unsigned long long) multiboot_info->mem_upper << 10);
+	}
+}
+
+static void
+memory_end_update (unsigned long long base, unsigned long long length)
+{
+	if (base + length > memory_end) {
+		memory_end = base + length;
+	}
+}
+
+static void
+allocate_frames ()
+{
+	unsigned int mapsize, fullsize, full2size;
+
+	memory_end = 0;
+	memory_foreach(memory_end_update);
+	if (memory_end > PMM_MEMORY_LIMIT) {
+		memory_end = PMM_MEMORY_LIMIT;
+	}
+	frames_count = memory_end >> 12;
+
+	/* Page frames are accessed through the direct map, so memory past
+	 * the direct map is left to the highmem bitmap.  */
+	high_count = 0;
+	if (frames_count > FRAME_NUMBER(PAGING_DIRECT_MAP)) {
+		high_count = frames_count - FRAME_NUMBER(PAGING_DIRECT_MAP);
+		frames_count = FRAME_NUMBER(PAGING_DIRECT_MAP);
+	}
+
+	mapsize = BIT_INDEX(frames_count);
+	if (BIT_OFFSET(frames_count) != 0) {
+		mapsize++;
+	}
+	fullsize = BIT_INDEX(mapsize - 1) + 1;
+	full2size = BIT_INDEX(fullsize - 1) + 1;
+	frames_hint = mapsize;
+
+	mapsize *= sizeof(unsigned int);
+	fullsize *= sizeof(unsigned int);
+	full2size *= sizeof(unsigned int);
+	frames_map = (unsigned int *) heap_alloc(mapsize);
+	frames_full = (unsigned int *) heap_alloc(fullsize);
+	frames_full2 = (unsigned int *) heap_alloc(full2size);
+
+	/* Every frame is in use until proven otherwise.  */
+	memset(frames_map, 0xFF, mapsize);
+	memset(frames_full, 0xFF, fullsize);
+	memset(frames_full2, 0xFF, full2size);
+}
+
+/**
+ * \brief Mark as free the frames of a memory region declared as available.
+ *
+ * Only the frames that fit completely inside the memory region are freed, in
+ * case the region does not start or end in a frame boundary.
+ *
+ * \param base the first address of the memory region.
+ * \param length the length of the memory region.
+ */
+static void
+release_system_block (unsigned long long base, unsigned long long length)
+{
+	unsigned long long first, last;
+
+	first = (base + 0xFFF) >> 12;
+	last = (base + length) >> 12;
+	if (last > frames_count) {
+		last = frames_count;
+	}
+	if (first < last) {
+		frames_mark(first, last - first, 0);
+	}
+}
+
+/**
+ * \brief Mark as free the highmem frames of an available memory region.
+ *
+ * This is done once the highmem bitmap exists, so the descriptors of the
+ * frames are also updated, and the frames are accounted to the zone.
+ *
+ * \param base the first address of the memory region.
+ * \param length the length of the memory region.
+ */
+static void
+release_high_block (unsigned long long base, unsigned long long length)
+{
+	unsigned long long first, last;
+
+	first = (base + 0xFFF) >> 12;
+	last = (base + length) >> 12;
+	if (first < frames_count) {
+		first = frames_count;
+	}
+	if (last > frames_count + high_count) {
+		last = frames_count + high_count;
+	}
+	for (; first < last; first++) {
+		high_clear(first);
+		frames_db[first].refcount = 0;
+		frames_db[first].flags = 0;
+		zone_total[PMM_ZONE_HIGH]++;
+		zone_free[PMM_ZONE_HIGH]++;
+	}
+}
+
+/**
+ * \brief Mark as free the frames available to the system.
+ *
+ * Only the areas declared as available memory are freed, so that no pages
+ * are ever allocated into reserved frames.
+ */
+static void
+release_system ()
+{
+	memory_foreach(release_system_block);
+}
+
+/**
+ * \brief Mark the frames of a memory region as in use and not allocatable.
+ *
+ * Once the page frame database exists, the descriptors of the frames also
+ * record who owns them, so this function can be called again on the same
+ * region to tag frames that were reserved before the database existed.  A
+ * frame shared by two regions keeps the owner that was recorded first, so
+ * that releasing one of the regions never releases the other one.
+ *
+ * \param start the first address of the memory region.
+ * \param end the address that follows the memory region.
+ * \param owner the owner of the frames, one of the PMM_OWNER constants.
+ */
+static void
+frames_reserve (physaddr_t start, physaddr_t end, unsigned int owner)
+{
+	frame_idx_t frame;
+
+	for (frame = FRAME_NUMBER(start);
+			PHYSICAL_ADDR(frame) < end && frame < frames_count;
+			frame++) {
+		frame_set(frame);
+		if (frames_db && frames_db[frame].owner == PMM_OWNER_NONE) {
+			frames_db[frame].refcount = 1;
+			frames_db[frame].flags = PMM_FRAME_RESERVED;
+			frames_db[frame].owner = owner;
+		}
 	}
 }
 
@@ -193,43 +696,552 @@ static void
 reserve_kernel ()
 {
 	extern char kernel_start, kernel_after;
-	physaddr_t addr;
-	frame_idx_t frame;
 
-	/* Start counting at the start of the page. */
-	addr = ((physaddr_t) &kernel_start) & 0xFFFFF000;
+	frames_reserve((unsigned int) &kernel_start,
+			(unsigned int) &kernel_after, PMM_OWNER_KERNEL);
+}
 
-	/* Mark pages in use by the kernel. */
-	for (frame = FRAME_NUMBER(addr);
-			addr < (physaddr_t) &kernel_after;
-			addr += 4096, frame++) {
-		frame_set(frame);
+/**
+ * \brief Mark the first megabyte of memory as in use.
+ *
+ * The first megabyte of memory is not reported as reserved by every
+ * bootloader, but it holds the real mode interrupt table, the BIOS data
+ * areas, the VGA memory window and the BIOS ROMs.  Also, frame 0 cannot be
+ * handed out, because the physical address 0 is the error value returned
+ * by pmm_alloc_page.
+ */
+static void
+reserve_lowmem ()
+{
+	frames_reserve(0, 0x100000, PMM_OWNER_FIRMWARE);
+}
+
+/**
+ * \brief Mark the memory pages in use by the multiboot modules as in use.
+ *
+ * The bootloader places the modules (such as the ramdisk) in memory regions
+ * that are reported as available, usually right after the kernel image.
+ * These frames must not be handed out while the modules are in use.
+ */
+static void
+reserve_modules ()
+{
+	multiboot_module_t *mods;
+	unsigned int i;
+
+	if (multiboot_info->flags & 0x08) {
+		mods = (multiboot_module_t *) multiboot_info->mods_addr;
+		for (i = 0; i < multiboot_info->mods_count; i++) {
+			frames_reserve(mods[i].mod_start, mods[i].mod_end,
+					PMM_OWNER_MODULE);
+		}
+	}
+}
+
+/**
+ * \brief Mark the memory in use by the multiboot information as in use.
+ *
+ * The multiboot information structure and the tables it points to are
+ * placed by the bootloader wherever it wants, and the kernel reads them
+ * after the physical memory manager is up (for instance, to find the
+ * ramdisk), so they must not be handed out either.
+ */
+static void
+reserve_bootinfo ()
+{
+	multiboot_module_t *mods;
+	unsigned int addr, i;
+
+	addr = (unsigned int) multiboot_info;
+	frames_reserve(addr, addr + sizeof(multiboot_info_t),
+			PMM_OWNER_BOOTINFO);
+	if (multiboot_info->flags & 0x04) {
+		addr = multiboot_info->command_line;
+		frames_reserve(addr, addr + strlen((char *) addr) + 1,
+				PMM_OWNER_BOOTINFO);
+	}
+	if (multiboot_info->flags & 0x08) {
+		mods = (multiboot_module_t *) multiboot_info->mods_addr;
+		addr = (unsigned int) mods;
+		frames_reserve(addr, addr + multiboot_info->mods_count
+				* sizeof(multiboot_module_t), PMM_OWNER_BOOTINFO);
+		for (i = 0; i < multiboot_info->mods_count; i++) {
+			addr = mods[i].string;
+			frames_reserve(addr, addr + strlen((char *) addr) + 1,
+					PMM_OWNER_BOOTINFO);
+		}
+	}
+	if (multiboot_info->flags & 0x40) {
+		addr = multiboot_info->mmap_addr;
+		frames_reserve(addr, addr + multiboot_info->mmap_length,
+				PMM_OWNER_BOOTINFO);
+	}
+}
+
+/**
+ * \brief Find a run of contiguous free frames.
+ * \param from the frame to start the search at.
+ * \param count the number of frames in the run.
+ * \return either -1 if no run is found, or the first frame of the run.
+ */
+static frame_idx_t
+frames_find_run (frame_idx_t from, frame_idx_t count)
+{
+	frame_idx_t idx, end;
+
+	while ((idx = frame_find_free(from)) < frames_count) {
+		for (end = idx + 1; end < idx + count && end < frames_count;
+				end++) {
+			if (frame_test(end)) {
+				break;
+			}
+		}
+		if (end == idx + count) {
+			return idx;
+		}
+		from = end + 1;
+	}
+	return -1;
+}
+
+/**
+ * \brief Carve the page frame database out of free memory.
+ *
+ * The database is placed in the normal zone if possible, so that it doesn't
+ * take the scarce DMA memory.  Frames that are in use at this point are the
+ * ones reserved during boot, so their descriptors are marked as reserved.
+ * The highmem bitmap is placed right after the database, and every highmem
+ * frame starts reserved until release_high_block frees it.
+ */
+static void
+allocate_database ()
+{
+	frame_idx_t first, count, idx;
+	unsigned int dbsize, highsize;
+
+	dbsize = (frames_count + high_count) * sizeof(struct pmm_frame);
+	highsize = BIT_INDEX(high_count + 31) * sizeof(unsigned int);
+	count = (dbsize + highsize + 0xFFF) >> 12;
+	first = frames_find_run(ZONE_NORMAL_START, count);
+	if (first >= frames_count) {
+		first = frames_find_run(0, count);
+	}
+	if (first >= frames_count) {
+		/* Not even enough memory to describe the memory.  */
+		kernel_die();
+	}
+	frames_mark(first, count, 1);
+	frames_db = (struct pmm_frame *) FRAME_POINTER(first);
+	high_map = (unsigned int *) ((char *) frames_db + dbsize);
+	high_hint = 0;
+	memset(high_map, 0xFF, highsize);
+
+	for (idx = 0; idx < frames_count + high_count; idx++) {
+		frames_db[idx].refcount = frame_used(idx) ? 1 : 0;
+		frames_db[idx].flags = frame_used(idx) ? PMM_FRAME_RESERVED : 0;
+		frames_db[idx].owner = PMM_OWNER_NONE;
+	}
+	for (idx = first; idx < first + count; idx++) {
+		frames_db[idx].owner = PMM_OWNER_PMM;
+	}
+}
+
+/**
+ * \brief Fill the free lists with the frames that are not in use.
+ *
+ * Every run of free frames in the bitmap is split in the biggest blocks that
+ * are aligned to their own size.
+ */
+static void
+buddy_seed ()
+{
+	frame_idx_t idx = 0, frame, size;
+	unsigned int order;
+
+	while ((idx = frame_find_free(idx)) < frames_count) {
+
+		/* Grow while aligned and while the upper half is free.  */
+		for (order = 0; order < PMM_ORDERS - 1; order++) {
+			size = 1 << (order + 1);
+			if ((idx & (size - 1)) != 0
+					|| idx + size > frames_count) {
+				break;
+			}
+			for (frame = idx + size / 2; frame < idx + size;
+					frame++) {
+				if (frame_test(frame)) {
+					break;
+				}
+			}
+			if (frame < idx + size) {
+				break;
+			}
+		}
+		buddy_link(idx, order);
+		zone_total[FRAME_ZONE(idx)] += 1 << order;
+		zone_free[FRAME_ZONE(idx)] += 1 << order;
+		idx += 1 << order;
 	}
 }
 
 void
 pmm_init ()
 {
+	unsigned int zone, order;
+
+	for (zone = 0; zone < PMM_ZONES; zone++) {
+		for (order = 0; order < PMM_ORDERS; order++) {
+			buddy_lists[zone][order] = 0;
+		}
+		zone_total[zone] = 0;
+		zone_free[zone] = 0;
+	}
+	zeroed_count = 0;
+	spinlock_init(&pmm_lock);
+
 	allocate_frames();
-	reserve_system();
+	release_system();
+	reserve_lowmem();
 	reserve_kernel();
-	// TODO: reserve_modules();
+	reserve_modules();
+	reserve_bootinfo();
+	allocate_database();
+
+	/* Now that the database exists, record who owns these frames.  */
+	reserve_lowmem();
+	reserve_kernel();
+	reserve_modules();
+	reserve_bootinfo();
+
+	buddy_seed();
+	memory_foreach(release_high_block);
+
+	/* The free lists take over, so the bitmap is never searched again.  */
+	heap_free(frames_full);
+	heap_free(frames_full2);
+	frames_full = 0;
+	frames_full2 = 0;
 }
 
-physaddr_t
-pmm_alloc_page ()
+/**
+ * \brief Take a block out of the free lists of a zone.
+ * \param zone the zone to take the block from.
+ * \param order the order of the block.
+ * \return the first frame of the block, or 0 if the zone has no such block.
+ */
+static frame_idx_t
+buddy_take (unsigned int zone, unsigned int order)
 {
-	frame_idx_t frame = frame_find_free();
-	if (frame == (unsigned int) -1) {
+	buddy_block_t * block;
+	unsigned int current;
+	frame_idx_t idx;
+
+	/* Find the smallest free block that is big enough.  */
+	for (current = order; current < PMM_ORDERS; current++) {
+		if (buddy_lists[zone][current]) {
+			break;
+		}
+	}
+	if (current == PMM_ORDERS) {
 		return 0;
+	}
+	block = buddy_lists[zone][current];
+	buddy_unlink(block);
+	idx = FRAME_NUMBER((unsigned int) block);
+
+	/* Split the block, giving back the upper halves.  */
+	while (current > order) {
+		current--;
+		buddy_link(idx + (1 << current), current);
+	}
+	return idx;
+}
+
+/**
+ * \brief Allocate a block from a zone, without falling back to other zones.
+ *
+ * The PMM lock must be held while calling this function.
+ *
+ * \param order the order of the block.
+ * \param zone the zone to take the block from.
+ * \param owner the owner of the block.
+ * \return the first frame of the block, or 0 if the zone has no such block.
+ */
+static frame_idx_t
+frames_take (unsigned int order, unsigned int zone, unsigned int owner)
+{
+	frame_idx_t idx, frame;
+
+	if (zone == PMM_ZONE_HIGH) {
+		/* Highmem only hands out single frames.  */
+		idx = order == 0 ? high_take() : 0;
+	} else if ((idx = buddy_take(zone, order)) != 0) {
+		frames_mark(idx, 1 << order, 1);
+	}
+	if (idx) {
+		zone_free[zone] -= 1 << order;
+		for (frame = idx; frame < idx + (1 << order); frame++) {
+			frames_db[frame].refcount = 1;
+			frames_db[frame].flags = 0;
+			frames_db[frame].owner = owner;
+		}
+	}
+	return idx;
+}
+
+/**
+ * \brief Allocate a block, falling back to the zones below the given one.
+ *
+ * The PMM lock must be held while calling this function.
+ */
+static frame_idx_t
+frames_take_any (unsigned int order, unsigned int zone, unsigned int owner)
+{
+	frame_idx_t idx;
+
+	for (;;) {
+		if ((idx = frames_take(order, zone, owner)) != 0 || zone == 0) {
+			return idx;
+		}
+		zone--;
+	}
+}
+
+/**
+ * \brief Put a single frame back in the free lists.
+ *
+ * The PMM lock must be held while calling this function.
+ */
+static void
+frames_give (frame_idx_t idx)
+{
+	frames_db[idx].refcount = 0;
+	frames_db[idx].owner = PMM_OWNER_NONE;
+	if (idx >= frames_count) {
+		high_clear(idx);
 	} else {
-		frame_set(frame);
-		return PHYSICAL_ADDR(frame);
+		frames_mark(idx, 1, 0);
+		buddy_insert(idx, 0);
+	}
+	zone_free[FRAME_ZONE(idx)]++;
+}
+
+/**
+ * \brief Give the pool of zeroed frames back to the free lists.
+ *
+ * The PMM lock must be held while calling this function.
+ */
+static void
+zeroed_drain ()
+{
+	while (zeroed_count) {
+		frames_give(zeroed_frames[--zeroed_count]);
+	}
+}
+
+physaddr_t
+pmm_alloc_pages (unsigned int order, unsigned int zone, unsigned int owner)
+{
+	unsigned int exact = zone & PMM_ZONE_EXACT;
+	frame_idx_t idx;
+
+	zone &= ~PMM_ZONE_EXACT;
+	if (order >= PMM_ORDERS || zone >= PMM_ZONES) {
+		return 0;
 	}
+
+	spinlock_lock(&pmm_lock);
+	idx = exact ? frames_take(order, zone, owner)
+	    : frames_take_any(order, zone, owner);
+	if (!idx && zeroed_count && zone != PMM_ZONE_HIGH) {
+		/* The zeroed frames are the last resort.  */
+		zeroed_drain();
+		idx = exact ? frames_take(order, zone, owner)
+		    : frames_take_any(order, zone, owner);
+	}
+
+	spinlock_release(&pmm_lock);
+	return PHYSICAL_ADDR(idx);
+}
+
+void
+pmm_free_pages (physaddr_t addr, unsigned int order)
+{
+	frame_idx_t idx = FRAME_NUMBER(addr), frame;
+
+	if (order >= PMM_ORDERS || idx == 0 || (idx & ((1 << order) - 1))
+			|| idx + (1 << order) > frames_count + high_count
+			|| (idx >= frames_count && order != 0)) {
+		return;
+	}
+
+	spinlock_lock(&pmm_lock);
+	/* A saturated count no longer says who holds the block.  */
+	if (frame_used(idx) && frames_db[idx].refcount != PMM_REFCOUNT_MAX) {
+		if (frames_db[idx].refcount > 1) {
+			/* Someone else still uses the block.  */
+			frames_db[idx].refcount--;
+		} else if (!(frames_db[idx].flags & PMM_FRAME_RESERVED)) {
+			for (frame = idx; frame < idx + (1 << order); frame++) {
+				frames_db[frame].refcount = 0;
+				frames_db[frame].owner = PMM_OWNER_NONE;
+			}
+			if (idx >= frames_count) {
+				high_clear(idx);
+			} else {
+				frames_mark(idx, 1 << order, 0);
+				buddy_insert(idx, order);
+			}
+			zone_free[FRAME_ZONE(idx)] += 1 << order;
+		}
+	}
+	spinlock_release(&pmm_lock);
+}
+
+physaddr_t
+pmm_alloc_page (unsigned int zone, unsigned int owner)
+{
+	return pmm_alloc_pages(0, zone, owner);
 }
 
 void
 pmm_free_page (physaddr_t page)
 {
-	frame_clear(FRAME_NUMBER(page));
+	pmm_free_pages(page, 0);
+}
+
+physaddr_t
+pmm_alloc_zeroed_page (unsigned int zone, unsigned int owner)
+{
+	frame_idx_t idx = 0;
+	physaddr_t page;
+
+	if ((zone & ~PMM_ZONE_EXACT) == PMM_ZONE_HIGH) {
+		/* Highmem cannot be cleared here.  */
+		zone = PMM_ZONE_NORMAL | (zone & PMM_ZONE_EXACT);
+	}
+	if ((zone & ~PMM_ZONE_EXACT) == PMM_ZONE_NORMAL) {
+		spinlock_lock(&pmm_lock);
+		if (zeroed_count) {
+			idx = zeroed_frames[--zeroed_count];
+			frames_db[idx].owner = owner;
+		}
+		spinlock_release(&pmm_lock);
+		if (idx) {
+			return PHYSICAL_ADDR(idx);
+		}
+	}
+
+	/* Nothing in the pool, so the caller has to wait.  */
+	if ((page = pmm_alloc_page(zone, owner)) != 0) {
+		memset((void *) (unsigned int) page, 0, PAGE_SIZE);
+	}
+	return page;
+}
+
+int
+pmm_refill_zeroed ()
+{
+	frame_idx_t idx = 0;
+
+	spinlock_lock(&pmm_lock);
+	if (zeroed_count < ZEROED_MAX) {
+		idx = frames_take(0, PMM_ZONE_NORMAL, PMM_OWNER_PMM);
+	}
+	spinlock_release(&pmm_lock);
+	if (!idx) {
+		return 0;
+	}
+
+	/* Clear the frame without holding the lock.  */
+	memset(FRAME_POINTER(idx), 0, PAGE_SIZE);
+
+	spinlock_lock(&pmm_lock);
+	if (zeroed_count < ZEROED_MAX) {
+		zeroed_frames[zeroed_count++] = idx;
+	} else {
+		frames_give(idx);
+	}
+	spinlock_release(&pmm_lock);
+	return 1;
+}
+
+void
+pmm_page_ref (physaddr_t page)
+{
+	frame_idx_t idx = FRAME_NUMBER(page);
+
+	if (idx >= frames_count + high_count) {
+		return;
+	}
+
+	spinlock_lock(&pmm_lock);
+	if (frame_used(idx) && frames_db[idx].refcount != PMM_REFCOUNT_MAX) {
+		frames_db[idx].refcount++;
+	}
+	spinlock_release(&pmm_lock);
+}
+
+unsigned int
+pmm_reclaim (physaddr_t start, physaddr_t end, unsigned int owner)
+{
+	frame_idx_t idx, last;
+	unsigned int count = 0;
+
+	if (owner != PMM_OWNER_MODULE && owner != PMM_OWNER_BOOTINFO) {
+		return 0;
+	}
+
+	/* Only the frames that fit completely in the region.  */
+	idx = FRAME_NUMBER(start + 0xFFF);
+	last = FRAME_NUMBER(end);
+	if (last > frames_count) {
+		last = frames_count;
+	}
+
+	spinlock_lock(&pmm_lock);
+	for (; idx < last; idx++) {
+		if (!(frames_db[idx].flags & PMM_FRAME_RESERVED)
+				|| frames_db[idx].owner != owner) {
+			continue;
+		}
+		frames_db[idx].flags = 0;
+		zone_total[FRAME_ZONE(idx)]++;
+		if (frames_db[idx].refcount == 1) {
+			frames_give(idx);
+			count++;
+		} else {
+			/* The last pmm_free_page gives it back.  */
+			frames_db[idx].owner = PMM_OWNER_NONE;
+			if (frames_db[idx].refcount != PMM_REFCOUNT_MAX) {
+				frames_db[idx].refcount--;
+			}
+		}
+	}
+	spinlock_release(&pmm_lock);
+	return count;
+}
+
+struct pmm_frame *
+pmm_frame_of (physaddr_t page)
+{
+	frame_idx_t idx = FRAME_NUMBER(page);
+
+	return frames_db && idx < frames_count + high_count
+	    ? &frames_db[idx]
+	    : 0;
+}
+
+void
+pmm_get_stats (struct pmm_stats * stats)
+{
+	unsigned int zone;
+
+	spinlock_lock(&pmm_lock);
+	for (zone = 0; zone < PMM_ZONES; zone++) {
+		stats->total[zone] = zone_total[zone];
+		stats->free[zone] = zone_free[zone];
+	}
+	stats->zeroed = zeroed_count;
+	spinlock_release(&pmm_lock);
 }
@@ -0,0 +1,373 @@
+/*
+ * This file is part of NativeOS
+ * Copyright (C) 2015-2022 The NativeOS contributors
+ * SPDX-License-Identifier:  GPL-3.0-only
+ */
+
+/**
+ * \file vmalloc.c
+ * \brief i386 implementation of the vmalloc window
+ *
+ * The vmalloc window spans from the end of the heap window up to the page
+ * tables window.  Each reserved range is described by an area, and areas
+ * are kept in a list sorted by address.  A new range is placed in the first
+ * gap between areas that is big enough, always leaving an unmapped guard
+ * page after it.  The first page of the window is never used either, so
+ * there is also an unmapped page below every range, which is what makes
+ * kernel stacks placed here safe to overflow.
+ *
+ * No page frame is mapped when a range is reserved.  When the kernel touches
+ * a page of a range for the first time, the page fault handler finds the
+ * area the address belongs to, and maps a zeroed page frame there, taken
+ * from the pool of frames zeroed in advance when possible.
+ *
+ * Private areas are different: every page is mapped read-only to the page
+ * frames of some memory that already exists, such as a file in the ramdisk,
+ * when the area is created.  The first write to one of these pages faults,
+ * and the page fault handler maps a private copy of the page frame there.
+ * Kernel writes only fault on read-only pages because CR0.WP is set.
+ *
+ * Physical areas map an existing physical memory region, such as a linear
+ * framebuffer, when they are created.  Their range is placed so that it has
+ * the same offset inside a large page as the physical region, so every large
+ * page sized block of the region can be mapped using a single large page.
+ *
+ * Any other page fault is still a fatal error.
+ */
+
+#include <kernel/cpu/idt.h>
+#include <kernel/mem/heap.h>
+#include <kernel/mem/pmm.h>
+#include <kernel/mem/vmalloc.h>
+#include <machine/paging.h>
+#include <sys/spinlock.h>
+#include <sys/stdkern.h>
+
+/** First virtual address of the vmalloc window.  */
+#define VMALLOC_START 0xE0000000
+
+/** Virtual address past the end of the vmalloc window.  */
+#define VMALLOC_END PAGING_RECURSIVE_BASE
+
+/** Interrupt vector of the page fault exception.  */
+#define VMALLOC_PAGE_FAULT 14
+
+/** Page fault error code bit set when the page was present.  */
+#define VMALLOC_FAULT_PRESENT 0x01
+
+/** Page fault error code bit set when the access was a write.  */
+#define VMALLOC_FAULT_WRITE 0x02
+
+/** The area is a private mapping, its pages are copied on write.  */
+#define VMALLOC_AREA_COW 0x01
+
+/** The area maps a physical memory region that is not owned by vmalloc.  */
+#define VMALLOC_AREA_PHYS 0x02
+
+struct vmalloc_area {
+	unsigned int start;
+	unsigned int size;
+	unsigned int flags;
+	struct vmalloc_area *next;
+};
+
+extern void kernel_die(void);
+
+/* Reserved ranges, sorted by address.  */
+static struct vmalloc_area *vmalloc_areas;
+
+/*
+ * Protects the list of areas.  The page fault handler takes it too, so it is
+ * always held with the interrupts disabled, and no lazy page may be touched
+ * while it is held, or the fault would spin on a lock this processor holds.
+ */
+static struct spinlock vmalloc_lock;
+
+/**
+ * \brief Disable the interrupts and take the vmalloc lock.
+ * \return the value of EFLAGS before disabling the interrupts.
+ */
+static inline unsigned int
+vmalloc_lock_irq(void)
+{
+	unsigned int flags;
+	__asm__ volatile("pushfl; popl %0; cli" : "=r"(flags) : : "memory");
+	spinlock_lock(&vmalloc_lock);
+	return flags;
+}
+
+/**
+ * \brief Release the vmalloc lock and restore the interrupt flag.
+ * \param flags the value returned by vmalloc_lock_irq.
+ */
+static inline void
+vmalloc_unlock_irq(unsigned int flags)
+{
+	spinlock_release(&vmalloc_lock);
+	__asm__ volatile("pushl %0; popfl" : : "r"(flags) : "memory", "cc");
+}
+
+/**
+ * \brief Find the area an address belongs to.
+ *
+ * The vmalloc lock must be held while calling this function.
+ *
+ * \param addr the virtual address.
+ * \return the area, or NULL if the address is not in a reserved range.
+ */
+static struct vmalloc_area *
+vmalloc_area_of(unsigned int addr)
+{
+	struct vmalloc_area *area;
+
+	for (area = vmalloc_areas; area && area->start <= addr;
+	     area = area->next) {
+		if (addr - area->start < area->size) {
+			return area;
+		}
+	}
+	return 0;
+}
+
+/**
+ * \brief Map a zeroed page frame into a page that was never touched.
+ * \param page the virtual address of the page.
+ * \return the page frame, or 0 if there is no memory.
+ */
+static physaddr_t
+vmalloc_populate(unsigned int page)
+{
+	physaddr_t frame;
+
+	/*
+	 * Highmem is only usable once mapped, so it is preferred here.  It is
+	 * never zeroed in advance, so it is cleared through the new mapping.
+	 */
+	frame = pmm_alloc_page(PMM_ZONE_HIGH | PMM_ZONE_EXACT,
+	    PMM_OWNER_VMALLOC);
+	if (frame) {
+		if (vmm_map(page, frame, VMM_WRITE) != 0) {
+			pmm_free_page(frame);
+			return 0;
+		}
+		memset((void *) page, 0, PAGE_SIZE);
+		return frame;
+	}
+
+	frame = pmm_alloc_zeroed_page(PMM_ZONE_NORMAL, PMM_OWNER_VMALLOC);
+	if (frame && vmm_map(page, frame, VMM_WRITE) != 0) {
+		pmm_free_page(frame);
+		frame = 0;
+	}
+	return frame;
+}
+
+/**
+ * \brief Replace a shared read-only page with a private writable copy.
+ * \param page the virtual address of the page.
+ * \return the page frame of the copy, or 0 if there is no memory.
+ */
+static physaddr_t
+vmalloc_copy(unsigned int page)
+{
+	physaddr_t frame, shared;
+
+	shared = vmm_translate(page);
+	frame = pmm_alloc_page(PMM_ZONE_NORMAL, PMM_OWNER_VMALLOC);
+	if (frame) {
+		memcpy((void *) (unsigned int) frame, (void *) page, PAGE_SIZE);
+		if (vmm_map(page, frame, VMM_WRITE) != 0) {
+			pmm_free_page(frame);
+			return 0;
+		}
+		pmm_free_page(shared);
+	}
+	return frame;
+}
+
+static void
+vmalloc_fault(struct idt_data *data)
+{
+	struct vmalloc_area *area;
+	unsigned int addr, page;
+	physaddr_t frame = 0;
+	unsigned int flags;
+
+	__asm__ volatile("movl %%cr2, %0" : "=r"(addr));
+	page = addr & ~(PAGE_SIZE - 1);
+
+	flags = vmalloc_lock_irq();
+	if ((area = vmalloc_area_of(addr)) != 0
+	    && !(area->flags & VMALLOC_AREA_PHYS)) {
+		if (!(data->err_code & VMALLOC_FAULT_PRESENT)) {
+			frame = vmalloc_populate(page);
+		} else if ((area->flags & VMALLOC_AREA_COW)
+		           && (data->err_code & VMALLOC_FAULT_WRITE)) {
+			frame = vmalloc_copy(page);
+		}
+	}
+	vmalloc_unlock_irq(flags);
+
+	if (!frame) {
+		/* Not a lazy page, or out of memory.  */
+		kernel_die();
+	}
+}
+
+void
+vmalloc_init(void)
+{
+	vmalloc_areas = 0;
+	spinlock_init(&vmalloc_lock);
+	idt_set_handler(VMALLOC_PAGE_FAULT, &vmalloc_fault);
+}
+
+/**
+ * \brief Reserve a range of the vmalloc window.
+ *
+ * The start of the range is placed at the given offset from a multiple of
+ * the alignment.  Use PAGE_SIZE and 0 when the placement is not important.
+ *
+ * \param size the amount of bytes to reserve.
+ * \param align the alignment of the range, a power of two.
+ * \param phase the offset of the range from the alignment, page aligned.
+ * \param flags the flags for the area.
+ * \return the new area, or NULL in case of error.
+ */
+static struct vmalloc_area *
+vmalloc_reserve(size_t size,
+    unsigned int align,
+    unsigned int phase,
+    unsigned int flags)
+{
+	struct vmalloc_area *area, *next, **link;
+	unsigned int start = VMALLOC_START + PAGE_SIZE, irq;
+
+	size = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+	if (size == 0 || size > VMALLOC_END - VMALLOC_START - 2 * PAGE_SIZE) {
+		return 0;
+	}
+	if ((area = heap_alloc(sizeof(struct vmalloc_area))) == 0) {
+		return 0;
+	}
+
+	irq = vmalloc_lock_irq();
+
+	/* Find the first gap that fits the range and its guard page.  */
+	start += (phase - start) & (align - 1);
+	for (link = &vmalloc_areas; (next = *link) != 0; link = &next->next) {
+		if (next->start >= start
+		    && next->start - start >= size + PAGE_SIZE) {
+			break;
+		}
+		start = next->start + next->size + PAGE_SIZE;
+		start += (phase - start) & (align - 1);
+	}
+	if (!next && (start > VMALLOC_END
+	    || VMALLOC_END - start < size + PAGE_SIZE)) {
+		vmalloc_unlock_irq(irq);
+		heap_free(area);
+		return 0;
+	}
+	area->start = start;
+	area->size = size;
+	area->flags = flags;
+	area->next = next;
+	*link = area;
+
+	vmalloc_unlock_irq(irq);
+	return area;
+}
+
+void *
+vmalloc(size_t size)
+{
+	struct vmalloc_area *area = vmalloc_reserve(size, PAGE_SIZE, 0, 0);
+	return area ? (void *) area->start : 0;
+}
+
+void *
+vmap_private(const void *data, size_t size)
+{
+	unsigned int first = (unsigned int) data & ~(PAGE_SIZE - 1);
+	unsigned int offset = (unsigned int) data - first;
+	struct vmalloc_area *area;
+	unsigned int page;
+	physaddr_t frame;
+
+	area = vmalloc_reserve(offset + size, PAGE_SIZE, 0, VMALLOC_AREA_COW);
+	if (area == 0) {
+		return 0;
+	}
+	for (page = 0; page < area->size; page += PAGE_SIZE) {
+		frame = vmm_translate(first + page);
+		if (frame == 0 || vmm_map(area->start + page, frame, 0) != 0) {
+			vfree((void *) area->start);
+			return 0;
+		}
+		/* Shared with the original, so it is not freed too early.  */
+		pmm_page_ref(frame);
+	}
+	return (void *) (area->start + offset);
+}
+
+void *
+vmap_physical(physaddr_t phys, size_t size, unsigned int flags)
+{
+	physaddr_t first = phys & ~(PAGE_SIZE - 1);
+	unsigned int offset = phys - first;
+	struct vmalloc_area *area;
+
+	area = vmalloc_reserve(offset + size, PAGING_LARGE_SIZE,
+	    first & (PAGING_LARGE_SIZE - 1), VMALLOC_AREA_PHYS);
+	if (area == 0) {
+		return 0;
+	}
+	if (vmm_map_range(area->start, first, area->size, flags) != 0) {
+		vfree((void *) area->start);
+		return 0;
+	}
+	return (void *) (area->start + offset);
+}
+
+void
+vfree(void *ptr)
+{
+	struct vmalloc_area *area, **link;
+	struct vmm_gather gather;
+	unsigned int addr, flags;
+	physaddr_t frame;
+
+	flags = vmalloc_lock_irq();
+	area = vmalloc_area_of((unsigned int) ptr);
+	vmalloc_unlock_irq(flags);
+
+	if (!area || area->start != ((unsigned int) ptr & ~(PAGE_SIZE - 1))) {
+		return;
+	}
+	if (area->flags & VMALLOC_AREA_PHYS) {
+		/* The page frames belong to somebody else.  */
+		vmm_unmap_range(area->start, area->size);
+	} else {
+		/*
+		 * The page frames can be given back before the TLB is flushed,
+		 * since the range stays reserved until then, so nobody else
+		 * can reach them through a stale translation.
+		 */
+		vmm_gather_init(&gather);
+		for (addr = area->start; addr < area->start + area->size;
+		     addr += PAGE_SIZE) {
+			if ((frame = vmm_unmap_gather(addr, &gather)) != 0) {
+				pmm_free_page(frame);
+			}
+		}
+		vmm_gather_flush(&gather);
+	}
+
+	flags = vmalloc_lock_irq();
+	for (link = &vmalloc_areas; *link != area; link = &(*link)->next)
+		;
+	*link = area->next;
+	vmalloc_unlock_irq(flags);
+	heap_free(area);
+}
@@ -0,0 +1,109 @@
+/*
+ * This file is part of NativeOS
+ * Copyright (C) 2015-2022 The NativeOS contributors
+ * SPDX-License-Identifier:  GPL-3.0-only
+ */
+
+/**
+ * \file
+ * \brief Kernel heap statistics device
+ *
+ * This device exposes the counters kept by the kernel heap, so that the
+ * state of the heap can be watched without stopping the system.  A snapshot
+ * of the counters is taken every time the device is opened, and reading the
+ * device returns the snapshot.  If the device is opened in binary mode, the
+ * snapshot is returned as a struct heap_stats.  Otherwise, it is returned as
+ * text, one counter per line, followed by the amount of free blocks in each
+ * size class that is not empty.
+ */
+
+#include <device/snapshot.h>
+#include <kernel/mem/heap.h>
+#include <sys/device.h>
+#include <sys/vfs.h>
+
+static int heapstat_init(void);
+static int heapstat_open(unsigned int flags);
+static int heapstat_close(void);
+static unsigned int heapstat_read(unsigned char *buf, unsigned int len);
+
+static driver_t heapstat_driver = {
+    .drv_name = "heapstat",
+    .drv_flags = DV_FCHARDEV,
+    .drv_init = &heapstat_init,
+};
+
+static device_t heapstat_device = {
+    .dev_family = &heapstat_driver,
+    .dev_open = &heapstat_open,
+    .dev_close = &heapstat_close,
+    .dev_read_chr = &heapstat_read,
+};
+
+/* The counters taken when the device was opened.  */
+static struct heap_stats heapstat_counters;
+
+static char heapstat_text[1024];
+static struct snapshot heapstat_snapshot = SNAPSHOT_INIT(heapstat_text);
+
+static void
+heapstat_format(void)
+{
+	struct heap_stats *stats = &heapstat_counters;
+	struct snapshot *snap = &heapstat_snapshot;
+	unsigned int class;
+
+	snapshot_text(snap);
+	snapshot_printf(snap, "total %u\n", stats->total_bytes);
+	snapshot_printf(snap, "used %u\n", stats->used_bytes);
+	snapshot_printf(snap, "free %u\n", stats->free_bytes);
+	snapshot_printf(snap, "largest %u\n", stats->largest_free);
+	snapshot_printf(snap, "blocks %u\n", stats->blocks);
+	snapshot_printf(snap, "freeblocks %u\n", stats->free_blocks);
+	snapshot_printf(snap, "allocs %u\n", stats->allocs);
+	snapshot_printf(snap, "frees %u\n", stats->frees);
+	snapshot_printf(snap, "failures %u\n", stats->failures);
+	snapshot_printf(snap, "cached %u\n", stats->cached_blocks);
+	snapshot_printf(snap, "pool %u\n", stats->pool_blocks);
+	snapshot_printf(snap, "poolused %u\n", stats->pool_used);
+	for (class = 0; class < HEAP_CLASSES; class++) {
+		if (stats->classes[class]) {
+			snapshot_printf(snap, "class %u %u\n", class,
+			    stats->classes[class]);
+		}
+	}
+}
+
+static int
+heapstat_init(void)
+{
+	device_install(&heapstat_device, "heapstat");
+	return 0;
+}
+
+static int
+heapstat_open(unsigned int flags)
+{
+	heap_get_stats(&heapstat_counters);
+	if (flags & VO_FBINARY) {
+		snapshot_binary(&heapstat_snapshot, &heapstat_counters,
+		    sizeof(heapstat_counters));
+	} else {
+		heapstat_format();
+	}
+	return 0;
+}
+
+static int
+heapstat_close(void)
+{
+	return 0;
+}
+
+static unsigned int
+heapstat_read(unsigned char *buf, unsigned int len)
+{
+	return snapshot_read(&heapstat_snapshot, buf, len);
+}
+
+DEVICE_DESCRIPTOR(heapstat, heapstat_driver);
@@ -0,0 +1,196 @@
+/*
+ * This file is part of NativeOS
+ * Copyright (C) 2015-2022 The NativeOS contributors
+ * SPDX-License-Identifier:  GPL-3.0-only
+ */
+
+/**
+ * \file
+ * \brief Kernel heap trace report device
+ *
+ * When the kernel is built with the heaptrace option, the kernel heap records
+ * the most recent allocations and deallocations in a ring buffer.  This
+ * device aggregates the contents of the ring buffer per call site every time
+ * it is opened.  A call site is identified by the chain of return addresses
+ * recorded for the entry, innermost first, so that allocations made through
+ * wrappers such as malloc or strdup can still be told apart.
+ *
+ * Each line of the report describes a call site:
+ *
+ *     A|F count bytes live addr0 addr1 addr2
+ *
+ * A lines describe call sites that allocate memory and F lines describe call
+ * sites that free memory.  For allocation sites, live is the amount of memory
+ * regions allocated in the traced window that have not been freed yet, which
+ * is a good hint of a memory leak if it keeps growing.  Addresses can be
+ * translated into function names with addr2line or gdb.
+ */
+
+#include <config.h>
+#include <device/snapshot.h>
+#include <kernel/mem/heap.h>
+#include <sys/device.h>
+
+#ifndef HEAPTRACE_ENTRIES
+#define HEAPTRACE_ENTRIES 512
+#endif
+
+/** Maximum amount of call sites in a report.  */
+#define HEAPTRACE_SITES 64
+
+struct heaptrace_site {
+	unsigned int op;
+	unsigned int count;
+	unsigned int bytes;
+	unsigned int live;
+	void *callers[HEAPTRACE_DEPTH];
+};
+
+static int heaptrace_init(void);
+static int heaptrace_open(unsigned int flags);
+static int heaptrace_close(void);
+static unsigned int heaptrace_dev_read(unsigned char *buf, unsigned int len);
+
+static driver_t heaptrace_driver = {
+    .drv_name = "heaptrace",
+    .drv_flags = DV_FCHARDEV,
+    .drv_init = &heaptrace_init,
+};
+
+static device_t heaptrace_device = {
+    .dev_family = &heaptrace_driver,
+    .dev_open = &heaptrace_open,
+    .dev_close = &heaptrace_close,
+    .dev_read_chr = &heaptrace_dev_read,
+};
+
+static struct heaptrace_entry heaptrace_entries[HEAPTRACE_ENTRIES];
+static struct heaptrace_site heaptrace_sites[HEAPTRACE_SITES];
+static char heaptrace_text[HEAPTRACE_SITES * 80];
+static struct snapshot heaptrace_snapshot = SNAPSHOT_INIT(heaptrace_text);
+
+/**
+ * \brief Find the call site for a trace entry, adding it if new.
+ * \param entry the trace entry.
+ * \param sites the amount of call sites already in the report.
+ * \return the call site, or NULL if there is no room for more call sites.
+ */
+static struct heaptrace_site *
+heaptrace_site_of(struct heaptrace_entry *entry, unsigned int *sites)
+{
+	struct heaptrace_site *site;
+	unsigned int i, j;
+
+	for (i = 0; i < *sites; i++) {
+		site = &heaptrace_sites[i];
+		if (site->op != entry->op) {
+			continue;
+		}
+		for (j = 0; j < HEAPTRACE_DEPTH; j++) {
+			if (site->callers[j] != entry->callers[j]) {
+				break;
+			}
+		}
+		if (j == HEAPTRACE_DEPTH) {
+			return site;
+		}
+	}
+
+	if (*sites == HEAPTRACE_SITES) {
+		return 0;
+	}
+	site = &heaptrace_sites[(*sites)++];
+	site->op = entry->op;
+	site->count = 0;
+	site->bytes = 0;
+	site->live = 0;
+	for (j = 0; j < HEAPTRACE_DEPTH; j++) {
+		site->callers[j] = entry->callers[j];
+	}
+	return site;
+}
+
+/**
+ * \brief Test whether the memory region allocated by an entry is freed later.
+ * \param entries the amount of entries read from the ring buffer.
+ * \param index the index of the allocation entry.
+ * \return non-zero if the memory region is freed by a following entry.
+ */
+static int
+heaptrace_freed(unsigned int entries, unsigned int index)
+{
+	void *ptr = heaptrace_entries[index].ptr;
+
+	while (++index < entries) {
+		if (heaptrace_entries[index].ptr == ptr) {
+			return heaptrace_entries[index].op == HEAPTRACE_FREE;
+		}
+	}
+	return 0;
+}
+
+static void
+heaptrace_report(void)
+{
+	struct heaptrace_entry *entry;
+	struct heaptrace_site *site;
+	unsigned int entries, sites = 0, i, j;
+
+	snapshot_text(&heaptrace_snapshot);
+	entries = heaptrace_read(heaptrace_entries, HEAPTRACE_ENTRIES);
+	for (i = 0; i < entries; i++) {
+		entry = &heaptrace_entries[i];
+		if (!entry->ptr) {
+			continue;
+		}
+		if ((site = heaptrace_site_of(entry, &sites)) == 0) {
+			continue;
+		}
+		site->count++;
+		site->bytes += entry->size;
+		if (entry->op == HEAPTRACE_ALLOC
+				&& !heaptrace_freed(entries, i)) {
+			site->live++;
+		}
+	}
+
+	for (i = 0; i < sites; i++) {
+		site = &heaptrace_sites[i];
+		snapshot_printf(&heaptrace_snapshot, "%c %u %u %u",
+		    site->op == HEAPTRACE_ALLOC ? 'A' : 'F', site->count,
+		    site->bytes, site->live);
+		for (j = 0; j < HEAPTRACE_DEPTH; j++) {
+			snapshot_printf(&heaptrace_snapshot, " %p",
+			    site->callers[j]);
+		}
+		snapshot_printf(&heaptrace_snapshot, "\n");
+	}
+}
+
+static int
+heaptrace_init(void)
+{
+	device_install(&heaptrace_device, "heaptrace");
+	return 0;
+}
+
+static int
+heaptrace_open(unsigned int flags)
+{
+	heaptrace_report();
+	return 0;
+}
+
+static int
+heaptrace_close(void)
+{
+	return 0;
+}
+
+static unsigned int
+heaptrace_dev_read(unsigned char *buf, unsigned int len)
+{
+	return snapshot_read(&heaptrace_snapshot, buf, len);
+}
+
+DEVICE_DESCRIPTOR(heaptrace, heaptrace_driver);
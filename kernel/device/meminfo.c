@@ -0,0 +1,105 @@
+/*
+ * This file is part of NativeOS
+ * Copyright (C) 2015-2022 The NativeOS contributors
+ * SPDX-License-Identifier:  GPL-3.0-only
+ */
+
+/**
+ * \file
+ * \brief Physical memory usage device
+ *
+ * Reports how much memory the physical memory manager has, and how much of
+ * it is free, as of the moment the device was opened.  In binary mode the
+ * report is the struct pmm_stats filled by pmm_get_stats, counted in page
+ * frames.  In text mode the counters are converted to kilobytes and given
+ * as "label value kB" lines: the sums over every zone first, then the
+ * frames zeroed in advance, and last each zone by its name.
+ */
+
+#include <device/snapshot.h>
+#include <kernel/mem/pmm.h>
+#include <sys/device.h>
+#include <sys/vfs.h>
+
+static int meminfo_init(void);
+static int meminfo_open(unsigned int flags);
+static int meminfo_close(void);
+static unsigned int meminfo_read(unsigned char *buf, unsigned int len);
+
+static driver_t meminfo_driver = {
+    .drv_name = "meminfo",
+    .drv_flags = DV_FCHARDEV,
+    .drv_init = &meminfo_init,
+};
+
+static device_t meminfo_device = {
+    .dev_family = &meminfo_driver,
+    .dev_open = &meminfo_open,
+    .dev_close = &meminfo_close,
+    .dev_read_chr = &meminfo_read,
+};
+
+static const char *meminfo_zones[PMM_ZONES] = {"dma", "normal", "high"};
+
+static struct pmm_stats meminfo_counters;
+
+/* Room for the totals and two lines per zone.  */
+static char meminfo_text[256];
+static struct snapshot meminfo_snapshot = SNAPSHOT_INIT(meminfo_text);
+
+static void
+meminfo_format(void)
+{
+	struct pmm_stats *stats = &meminfo_counters;
+	struct snapshot *snap = &meminfo_snapshot;
+	unsigned int zone, total = 0, free = 0;
+
+	for (zone = 0; zone < PMM_ZONES; zone++) {
+		total += stats->total[zone];
+		free += stats->free[zone];
+	}
+	snapshot_text(snap);
+	snapshot_printf(snap, "total %u kB\n", total * 4);
+	snapshot_printf(snap, "free %u kB\n", free * 4);
+	snapshot_printf(snap, "zeroed %u kB\n", stats->zeroed * 4);
+	for (zone = 0; zone < PMM_ZONES; zone++) {
+		snapshot_printf(snap, "%s total %u kB\n", meminfo_zones[zone],
+		    stats->total[zone] * 4);
+		snapshot_printf(snap, "%s free %u kB\n", meminfo_zones[zone],
+		    stats->free[zone] * 4);
+	}
+}
+
+static int
+meminfo_init(void)
+{
+	device_install(&meminfo_device, "meminfo");
+	return 0;
+}
+
+static int
+meminfo_open(unsigned int flags)
+{
+	pmm_get_stats(&meminfo_counters);
+	if (flags & VO_FBINARY) {
+		snapshot_binary(&meminfo_snapshot, &meminfo_counters,
+		    sizeof(meminfo_counters));
+	} else {
+		meminfo_format();
+	}
+	return 0;
+}
+
+static int
+meminfo_close(void)
+{
+	return 0;
+}
+
+static unsigned int
+meminfo_read(unsigned char *buf, unsigned int len)
+{
+	return snapshot_read(&meminfo_snapshot, buf, len);
+}
+
+DEVICE_DESCRIPTOR(meminfo, meminfo_driver);
@@ -8,8 +8,11 @@
  * running task has been using the CPU for an excessive amount of time.
  */
 
+#include <device/pctimer.h>
 #include <kernel/cpu/idt.h>
 #include <sys/device.h>
+#include <sys/kprintf.h>
+#include <sys/stdkern.h>
 
 static unsigned long next_ticks = 0;
 
@@ -39,6 +42,12 @@ pctimer_handler(struct idt_data *data)
 	next_ticks++;
 }
 
+unsigned long
+pctimer_ticks(void)
+{
+	return next_ticks;
+}
+
 static int
 pctimer_init(void)
 {
@@ -62,20 +71,14 @@ pctimer_close()
 static unsigned int
 pctimer_read(unsigned char *buf, unsigned int len)
 {
-	static char *letters = "0123456789ABCDEF";
-	unsigned int i, last, read = 0;
-	unsigned long ticks = next_ticks;
-	char conversion[8] = {0, 0, 0, 0, 0, 0, 0, 0};
-	for (i = 0; i < 8; i++) {
-		last = ticks & 0xF;
-		conversion[i] = letters[last];
-		ticks >>= 4;
-	}
-	for (i = 7; i >= 0 && len--; --i) {
-		*buf++ = conversion[i];
-		read++;
+	char text[9];
+
+	snprintf(text, sizeof(text), "%08lX", next_ticks);
+	if (len > 8) {
+		len = 8;
 	}
-	return read;
+	memcpy(buf, text, len);
+	return len;
 }
 
 DEVICE_DESCRIPTOR(pctimer, pctimer_driver);
@@ -0,0 +1,7 @@
+#pragma once
+
+/**
+ * \brief Get the amount of timer interrupts since the timer was installed.
+ * \return the amount of ticks.
+ */
+unsigned long pctimer_ticks(void);
@@ -5,6 +5,7 @@
 
 #include <machine/cpu.h>
 #include <sys/device.h>
+#include <sys/kprintf.h>
 
 #define REG_SECONDS 0
 #define REG_MINUTES 2
@@ -137,24 +138,6 @@ clock_open(unsigned int flags)
 	return 0;
 }
 
-static void
-write_number(unsigned char *buf, unsigned int num, unsigned int len)
-{
-	char tmp[16];
-	int i = 0;
-
-	while (num > 0) {
-		tmp[i++] = '0' + (num % 10);
-		num /= 10;
-	}
-	while (i < len) {
-		tmp[i++] = '0';
-	}
-	while (i >= 0) {
-		*buf++ = tmp[--i];
-	}
-}
-
 static unsigned int
 clock_read(unsigned char *buf, unsigned int len)
 {
@@ -165,13 +148,9 @@ clock_read(unsigned char *buf, unsigned int len)
 
 	update_clock();
 
-	write_number(&buf[0], rtc_clock.year, 4);
-	write_number(&buf[4], rtc_clock.month, 2);
-	write_number(&buf[6], rtc_clock.day, 2);
-	write_number(&buf[8], rtc_clock.hours, 2);
-	write_number(&buf[10], rtc_clock.minutes, 2);
-	write_number(&buf[12], rtc_clock.seconds, 2);
-	buf[14] = 0;
+	snprintf((char *) buf, 15, "%04u%02u%02u%02u%02u%02u", rtc_clock.year,
+	    rtc_clock.month, rtc_clock.day, rtc_clock.hours, rtc_clock.minutes,
+	    rtc_clock.seconds);
 	return 15;
 }
 
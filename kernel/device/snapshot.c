@@ -0,0 +1,54 @@
+/*
+ * This file is part of NativeOS
+ * Copyright (C) 2015-2022 The NativeOS contributors
+ * SPDX-License-Identifier:  GPL-3.0-only
+ */
+
+#include <device/snapshot.h>
+#include <sys/kprintf.h>
+#include <sys/stdkern.h>
+
+void
+snapshot_text(struct snapshot *snap)
+{
+	snap->buffer = (const unsigned char *) snap->text;
+	snap->length = 0;
+	snap->offset = 0;
+}
+
+void
+snapshot_printf(struct snapshot *snap, const char *fmt, ...)
+{
+	unsigned int space = snap->size - snap->length;
+	va_list args;
+	int len;
+
+	va_start(args, fmt);
+	len = vsnprintf(snap->text + snap->length, space, fmt, args);
+	va_end(args);
+
+	/* Keep the terminator in the buffer when the text is cut.  */
+	if ((unsigned int) len >= space) {
+		len = space ? space - 1 : 0;
+	}
+	snap->length += len;
+}
+
+void
+snapshot_binary(struct snapshot *snap, const void *data, unsigned int size)
+{
+	snap->buffer = (const unsigned char *) data;
+	snap->length = size;
+	snap->offset = 0;
+}
+
+unsigned int
+snapshot_read(struct snapshot *snap, unsigned char *buf, unsigned int len)
+{
+	if (len > snap->length - snap->offset) {
+		len = snap->length - snap->offset;
+	}
+	memcpy(buf, snap->buffer + snap->offset, len);
+	snap->offset += len;
+	return len;
+}
@@ -0,0 +1,66 @@
+/*
+ * This file is part of NativeOS
+ * Copyright (C) 2015-2022 The NativeOS contributors
+ * SPDX-License-Identifier:  GPL-3.0-only
+ */
+
+#pragma once
+
+/**
+ * \file
+ * \brief Read-only devices that report a snapshot
+ *
+ * Devices such as heapstat or meminfo build a report when they are opened,
+ * and every read returns the next piece of it.  The report is either text
+ * formatted into a buffer owned by the device, or a binary structure.
+ */
+
+/** A report being read.  */
+struct snapshot {
+	/** The text buffer of the device and its size. */
+	char *text;
+	unsigned int size;
+	/** The report, its length, and how much of it has been read. */
+	const unsigned char *buffer;
+	unsigned int length, offset;
+};
+
+/** Initialiser for a snapshot that uses the given array as text buffer.  */
+#define SNAPSHOT_INIT(array) {array, sizeof(array), 0, 0, 0}
+
+/**
+ * \brief Start a new text report, dropping the previous one.
+ * \param snap the snapshot.
+ */
+void snapshot_text(struct snapshot *snap);
+
+/**
+ * \brief Append formatted text to the report.
+ *
+ * Text that does not fit in the buffer is cut.
+ *
+ * \param snap the snapshot.
+ * \param fmt the format string.
+ */
+void snapshot_printf(struct snapshot *snap, const char *fmt, ...);
+
+/**
+ * \brief Report a binary structure instead of text.
+ * \param snap the snapshot.
+ * \param data the structure, which must live until the next report.
+ * \param size the size of the structure.
+ */
+void snapshot_binary(struct snapshot *snap,
+    const void *data,
+    unsigned int size);
+
+/**
+ * \brief Read the next piece of the report.
+ * \param snap the snapshot.
+ * \param buf the buffer where to copy the report.
+ * \param len the size of the buffer.
+ * \return the amount of bytes copied, 0 at the end of the report.
+ */
+unsigned int snapshot_read(struct snapshot *snap,
+    unsigned char *buf,
+    unsigned int len);
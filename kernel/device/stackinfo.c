@@ -0,0 +1,92 @@
+/*
+ * This file is part of NativeOS
+ * Copyright (C) 2015-2022 The NativeOS contributors
+ * SPDX-License-Identifier:  GPL-3.0-only
+ */
+
+/**
+ * \file
+ * \brief Kernel stack usage device
+ *
+ * This device reports the high-water mark of every kernel stack, so that
+ * the size of the stacks can be tuned with real data.  The stacks are
+ * measured every time the device is opened, and reading the device returns
+ * one line per stack:
+ *
+ *     name size used
+ *
+ * where size is the size of the stack and used is the deepest the stack has
+ * ever been, both in bytes.
+ */
+
+#include <device/snapshot.h>
+#include <kernel/mem/kstack.h>
+#include <sys/device.h>
+
+/** Maximum amount of stacks in a report.  */
+#define STACKINFO_STACKS 16
+
+static int stackinfo_init(void);
+static int stackinfo_open(unsigned int flags);
+static int stackinfo_close(void);
+static unsigned int stackinfo_read(unsigned char *buf, unsigned int len);
+
+static driver_t stackinfo_driver = {
+    .drv_name = "stackinfo",
+    .drv_flags = DV_FCHARDEV,
+    .drv_init = &stackinfo_init,
+};
+
+static device_t stackinfo_device = {
+    .dev_family = &stackinfo_driver,
+    .dev_open = &stackinfo_open,
+    .dev_close = &stackinfo_close,
+    .dev_read_chr = &stackinfo_read,
+};
+
+static struct kstack_info stackinfo_stacks[STACKINFO_STACKS];
+static char stackinfo_text[STACKINFO_STACKS * 48];
+static struct snapshot stackinfo_snapshot = SNAPSHOT_INIT(stackinfo_text);
+
+static void
+stackinfo_report(void)
+{
+	unsigned int stacks, i;
+
+	snapshot_text(&stackinfo_snapshot);
+	stacks = kstack_report(stackinfo_stacks, STACKINFO_STACKS);
+	for (i = 0; i < stacks; i++) {
+		/* Long names are cut, so that every line fits.  */
+		snapshot_printf(&stackinfo_snapshot, "%.24s %u %u\n",
+		    stackinfo_stacks[i].name, stackinfo_stacks[i].size,
+		    stackinfo_stacks[i].used);
+	}
+}
+
+static int
+stackinfo_init(void)
+{
+	device_install(&stackinfo_device, "stackinfo");
+	return 0;
+}
+
+static int
+stackinfo_open(unsigned int flags)
+{
+	stackinfo_report();
+	return 0;
+}
+
+static int
+stackinfo_close(void)
+{
+	return 0;
+}
+
+static unsigned int
+stackinfo_read(unsigned char *buf, unsigned int len)
+{
+	return snapshot_read(&stackinfo_snapshot, buf, len);
+}
+
+DEVICE_DESCRIPTOR(stackinfo, stackinfo_driver);
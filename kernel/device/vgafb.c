@@ -147,6 +147,22 @@ movecursor(unsigned short abspos)
 	port_out_byte(VGA_IOR_DATA, abspos & 0xFF);
 }
 
+static void
+scroll(struct vgafb_scroll *scroll)
+{
+	unsigned short *vga = (unsigned short *) VGA_BASE;
+	unsigned short *last;
+	unsigned int i;
+
+	if (scroll->rows == 0 || scroll->rows > VGA_ROWS) {
+		return;
+	}
+	memmove(vga, vga + VGA_COLS, (scroll->rows - 1) * VGA_COLS * 2);
+	last = vga + (scroll->rows - 1) * VGA_COLS;
+	for (i = 0; i < VGA_COLS; i++)
+		last[i] = scroll->fill;
+}
+
 static int
 vgafb_ioctl(int iorq, void *arg)
 {
@@ -157,6 +173,9 @@ vgafb_ioctl(int iorq, void *arg)
 	case VGAFB_IOCTL_MOVECUR:
 		movecursor(*(unsigned short *) arg);
 		return 0;
+	case VGAFB_IOCTL_SCROLL:
+		scroll((struct vgafb_scroll *) arg);
+		return 0;
 	}
 
 	return -1;
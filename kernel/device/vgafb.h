@@ -1,4 +1,17 @@
 #pragma once
 
 #define VGAFB_IOCTL_SETCUR 0x0
-#define VGAFB_IOCTL_MOVECUR 0x1
\ No newline at end of file
+#define VGAFB_IOCTL_MOVECUR 0x1
+#define VGAFB_IOCTL_SCROLL 0x2
+
+/**
+ * \brief Argument of the VGAFB_IOCTL_SCROLL request
+ *
+ * The first rows of the screen are moved up by one row, dropping the
+ * contents of the first one, and the last of them is filled with the
+ * given entry.  Rows below are left untouched.
+ */
+struct vgafb_scroll {
+	unsigned int rows;    /**< How many rows take part in the scroll.  */
+	unsigned short fill;  /**< Entry written in the row left empty.  */
+};
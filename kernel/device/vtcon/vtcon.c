@@ -12,6 +12,7 @@
 #include <device/vgafb.h>
 #include <device/vtcon/scancodes.h>
 #include <sys/device.h>
+#include <sys/kprintf.h>
 #include <sys/stdkern.h>
 #include <sys/vfs.h>
 
@@ -46,47 +47,25 @@ static vfs_node_t *clock = 0;
 static void
 drawstatus()
 {
-	char text[80], date[15];
+	char text[VGA_COLS + 1], date[15];
 	unsigned char fg, bg;
-	unsigned short buffer[80];
+	unsigned short buffer[VGA_COLS];
 	unsigned int i;
 
-	/* Compose status bar text. */
-	memset(text, 0, 80);
-	text[1] = '1' + current_context;
-	strncpy(&text[4], VERSION_NAME, 70);
+	/* Compose status bar text: console, version and the date. */
 	fs_read(clock, 0, &date, 15);
+	snprintf(text, sizeof(text),
+	    " %u  %-55.55s %.4s/%.2s/%.2s %.2s:%.2s:%.2s ", current_context + 1,
+	    VERSION_NAME, &date[0], &date[4], &date[6], &date[8], &date[10],
+	    &date[12]);
 
 	/* Render status bar. */
 	for (i = 0; i < VGA_COLS; i++) {
-		fg = i < 3 ? 0x1 : 0x7;
+		fg = i < 3 || i >= VGA_COLS - 21 ? 0x1 : 0x7;
 		bg = fg == 0x7 ? 0x1 : 0x7;
 		buffer[i] = VGA_ENTRY(text[i], fg, bg);
 	}
 
-	/* TODO: Add a sprintf function to never do this again. */
-	buffer[VGA_COLS - 21] = VGA_ENTRY(' ', 0x1, 0x7);
-	buffer[VGA_COLS - 20] = VGA_ENTRY(date[0], 0x1, 0x7);
-	buffer[VGA_COLS - 19] = VGA_ENTRY(date[1], 0x1, 0x7);
-	buffer[VGA_COLS - 18] = VGA_ENTRY(date[2], 0x1, 0x7);
-	buffer[VGA_COLS - 17] = VGA_ENTRY(date[3], 0x1, 0x7);
-	buffer[VGA_COLS - 16] = VGA_ENTRY('/', 0x1, 0x7);
-	buffer[VGA_COLS - 15] = VGA_ENTRY(date[4], 0x1, 0x7);
-	buffer[VGA_COLS - 14] = VGA_ENTRY(date[5], 0x1, 0x7);
-	buffer[VGA_COLS - 13] = VGA_ENTRY('/', 0x1, 0x7);
-	buffer[VGA_COLS - 12] = VGA_ENTRY(date[6], 0x1, 0x7);
-	buffer[VGA_COLS - 11] = VGA_ENTRY(date[7], 0x1, 0x7);
-	buffer[VGA_COLS - 10] = VGA_ENTRY(' ', 0x1, 0x7);
-	buffer[VGA_COLS - 9] = VGA_ENTRY(date[8], 0x1, 0x7);
-	buffer[VGA_COLS - 8] = VGA_ENTRY(date[9], 0x1, 0x7);
-	buffer[VGA_COLS - 7] = VGA_ENTRY(':', 0x1, 0x7);
-	buffer[VGA_COLS - 6] = VGA_ENTRY(date[10], 0x1, 0x7);
-	buffer[VGA_COLS - 5] = VGA_ENTRY(date[11], 0x1, 0x7);
-	buffer[VGA_COLS - 4] = VGA_ENTRY(':', 0x1, 0x7);
-	buffer[VGA_COLS - 3] = VGA_ENTRY(date[12], 0x1, 0x7);
-	buffer[VGA_COLS - 2] = VGA_ENTRY(date[13], 0x1, 0x7);
-	buffer[VGA_COLS - 1] = VGA_ENTRY(' ', 0x1, 0x7);
-
 	fs_write(con_fb, 2 * VGA_COLS * (VGA_ROWS - 1), buffer, sizeof(buffer));
 }
 
@@ -154,37 +133,15 @@ clearscreen()
 	syncfbcursor();
 }
 
-static inline void
-copyrow(unsigned int dst, unsigned int src)
-{
-	unsigned char buf[VGA_COLS * 2];
-	unsigned int dstofft, srcofft, read;
-	if (dst < VGA_ROWS && src < VGA_ROWS) {
-		srcofft = VGA_COLS * src * 2;
-		dstofft = VGA_COLS * dst * 2;
-		read = fs_read(con_fb, srcofft, buf, VGA_COLS * 2);
-		fs_write(con_fb, dstofft, buf, read);
-	}
-}
-
-static inline void
-clearrow(unsigned int row)
-{
-	unsigned int i;
-	unsigned int rowofft = VGA_COLS * row * 2;
-	unsigned short value = context->fg << 8;
-	for (i = 0; i < VGA_COLS; i++)
-		fs_write(con_fb, rowofft + 2 * i, &value, 2);
-}
-
 static inline void
 moveline()
 {
-	unsigned int row;
+	struct vgafb_scroll scroll;
 	if (++context->cy == VGA_ROWS - 1) {
-		for (row = 1; row < VGA_ROWS - 1; row++)
-			copyrow(row - 1, row);
-		clearrow(VGA_ROWS - 2);
+		/* Scroll every row but the status bar. */
+		scroll.rows = VGA_ROWS - 1;
+		scroll.fill = context->fg << 8;
+		fs_ioctl(con_fb, VGAFB_IOCTL_SCROLL, &scroll);
 		context->cy = VGA_ROWS - 2;
 	}
 }
@@ -1,5 +1,7 @@
 #include <fs/tarfs/tar.h>
 #include <stddef.h>
+#include <sys/arena.h>
+#include <sys/kmem.h>
 #include <sys/list.h>
 #include <sys/stdkern.h>
 #include <sys/vfs.h>
@@ -28,6 +30,9 @@ struct tarfs_payload {
 	vfs_node_t *root;
 };
 
+/** Object cache for the tarfs_node of every mounted TAR. */
+static kmem_cache_t *tarfs_nodes_cache;
+
 static unsigned int
 octal2int(char *octstring)
 {
@@ -44,7 +49,7 @@ decode_block(struct tarfs_payload *tar, tar_header_block_t *block)
 {
 	struct tarfs_node *tnode;
 
-	if ((tnode = malloc(sizeof(struct tarfs_node))) != 0) {
+	if ((tnode = kmem_cache_alloc(tarfs_nodes_cache)) != 0) {
 		tnode->block = block;
 		tnode->node = 0;
 		list_append(tar->nodes, tnode);
@@ -77,10 +82,13 @@ split_basename(char *path, char **dirname, char **basename)
 }
 
 static void reassemble_nodes(struct tarfs_payload *tarfile,
-                             struct tarfs_node *node);
+                             struct tarfs_node *node,
+                             arena_t *scratch);
 
 static vfs_node_t *
-lookup_vnode(struct tarfs_payload *tarfile, const char *path)
+lookup_vnode(struct tarfs_payload *tarfile,
+             const char *path,
+             arena_t *scratch)
 {
 	listnode_t *listnode;
 	struct tarfs_node *tarnode;
@@ -105,7 +113,7 @@ lookup_vnode(struct tarfs_payload *tarfile, const char *path)
 			kiwi[last_char] = 0;
 		}
 		if (!strncmp(kiwi, path, 256)) {
-			reassemble_nodes(tarfile, tarnode);
+			reassemble_nodes(tarfile, tarnode, scratch);
 			return tarnode->node;
 		}
 	}
@@ -113,16 +121,26 @@ lookup_vnode(struct tarfs_payload *tarfile, const char *path)
 	return NULL;
 }
 
+/**
+ * Build the VFS node for a TAR entry, and the VFS nodes for its parent
+ * directories if they are not built yet. Temporary copies of the paths are
+ * made in the scratch arena, which the caller resets once the entry is built
+ * and destroys when every entry is built.
+ */
 static void
-reassemble_nodes(struct tarfs_payload *tarfile, struct tarfs_node *node)
+reassemble_nodes(struct tarfs_payload *tarfile,
+                 struct tarfs_node *node,
+                 arena_t *scratch)
 {
-	char *orig_path, *path, *dirname, *basename;
+	char *path, *dirname, *basename;
 	unsigned int last_char;
 	vfs_node_t *vnode;
 
 	if (!node->node) {
-		orig_path = strdup(node->block->metadata.name);
-		path = orig_path;
+		path = arena_strdup(scratch, node->block->metadata.name);
+		if (!path) {
+			return;
+		}
 
 		/* Normalize paths removing absolute dir slashes and dots. */
 		if (*path == '.' && *(path + 1) == '/') {
@@ -140,12 +158,13 @@ reassemble_nodes(struct tarfs_payload *tarfile, struct tarfs_node *node)
 
 		/* Divide my path in dirname and basename. */
 
-		vnode = malloc(sizeof(vfs_node_t));
+		vnode = vfs_node_alloc();
 		vnode->vn_flags = 0;
 		if (*path) {
 			split_basename(path, &dirname, &basename);
 			strcpy(vnode->vn_name, basename);
-			vnode->vn_parent = lookup_vnode(tarfile, dirname);
+			vnode->vn_parent =
+			    lookup_vnode(tarfile, dirname, scratch);
 		} else {
 			strcpy(vnode->vn_name, "");
 			vnode->vn_parent = NULL;
@@ -165,8 +184,6 @@ reassemble_nodes(struct tarfs_payload *tarfile, struct tarfs_node *node)
 		vnode->vn_volume = tarfile->volume;
 		vnode->vn_payload = node;
 		node->node = vnode;
-
-		free(orig_path);
 	}
 }
 
@@ -176,6 +193,9 @@ init_nodes(struct tarfs_payload *tar)
 	unsigned int bx = 0, file_length;
 	tar_header_block_t *block = (tar_header_block_t *) tar->buf;
 	listnode_t *lnode;
+	struct tarfs_node *tnode;
+	arena_t scratch;
+	char fallback[512];
 
 	/* First we decode all the files in this TAR. */
 	while (*block[bx].metadata.name) {
@@ -187,13 +207,25 @@ init_nodes(struct tarfs_payload *tar)
 		}
 	}
 
-	/* Then we reassemble the vfs_node_t data structures. */
+	/*
+	 * Then we reassemble the vfs_node_t data structures. If the heap
+	 * cannot hold the scratch arena, a buffer in the stack is used. It
+	 * may be too small for the paths of a deep entry, which is then left
+	 * without a node and skipped by readdir and finddir.
+	 */
+	if (arena_create(&scratch, 2048) < 0) {
+		arena_init(&scratch, fallback, sizeof(fallback));
+	}
 	list_foreach(tar->nodes, lnode)
 	{
-		reassemble_nodes(tar, (struct tarfs_node *) lnode->data);
+		tnode = (struct tarfs_node *) lnode->data;
+		reassemble_nodes(tar, tnode, &scratch);
+		arena_reset(&scratch);
 	}
+	arena_destroy(&scratch);
 }
 
+static void tarfs_init(void);
 static int tarfs_mount(vfs_volume_t *volume);
 static int tarfs_open(vfs_node_t *node, unsigned int flags);
 static unsigned int tarfs_read(vfs_node_t *, unsigned, void *, unsigned);
@@ -201,6 +233,7 @@ static unsigned int tarfs_write(vfs_node_t *, unsigned, void *, unsigned);
 static int tarfs_close(vfs_node_t *node);
 static vfs_node_t *tarfs_readdir(vfs_node_t *node, unsigned int index);
 static vfs_node_t *tarfs_finddir(vfs_node_t *node, char *name);
+static const void *tarfs_mmap(vfs_node_t *node, unsigned int *size);
 
 static vfs_ops_t tarfs_ops = {
     .vfs_close = &tarfs_close,
@@ -208,17 +241,27 @@ static vfs_ops_t tarfs_ops = {
     .vfs_read = &tarfs_read,
     .vfs_readdir = &tarfs_readdir,
     .vfs_finddir = &tarfs_finddir,
+    .vfs_mmap = &tarfs_mmap,
 };
 
 static vfs_filesys_t tarfs_driver = {
     .fsd_ident = "tarfs",
     .fsd_name = "TAR File System",
+    .fsd_init = &tarfs_init,
     .fsd_mount = &tarfs_mount,
     .fsd_ops = &tarfs_ops,
 };
 
 FS_DESCRIPTOR(tarfs, tarfs_driver);
 
+static void
+tarfs_init(void)
+{
+	tarfs_nodes_cache = kmem_cache_create("tarfs_node",
+	                                      sizeof(struct tarfs_node),
+	                                      0);
+}
+
 static int
 tarfs_mount(vfs_volume_t *luna)
 {
@@ -272,6 +315,16 @@ tarfs_close(vfs_node_t *node)
 	return 0;
 }
 
+static const void *
+tarfs_mmap(vfs_node_t *node, unsigned int *size)
+{
+	struct tarfs_node *tar = (struct tarfs_node *) node->vn_payload;
+
+	/* File contents follow the header block in the ramdisk. */
+	*size = octal2int(tar->block->metadata.size);
+	return (unsigned char *) &tar->block->metadata + 512;
+}
+
 static vfs_node_t *
 tarfs_readdir(vfs_node_t *klairm_cocayketa_voltereta,
               unsigned int clank_will_not_die)
@@ -288,7 +341,9 @@ tarfs_readdir(vfs_node_t *klairm_cocayketa_voltereta,
 	{
 		kiwi = (struct tarfs_node *)
 		           esta_variable_es_del_mejor_mod_de_discord->data;
-		if (kiwi->node->vn_parent == klairm_cocayketa_voltereta) {
+		/* Entries without a node could not be built at mount. */
+		if (kiwi->node
+		    && kiwi->node->vn_parent == klairm_cocayketa_voltereta) {
 			if (clank_will_not_die == 0) {
 				return kiwi->node;
 			} else {
@@ -311,7 +366,7 @@ tarfs_finddir(vfs_node_t *node, char *name)
 	list_foreach(payload->nodes, listnode)
 	{
 		tarnode = (struct tarfs_node *) listnode->data;
-		if (tarnode->node->vn_parent == node
+		if (tarnode->node && tarnode->node->vn_parent == node
 		    && !strcmp(name, tarnode->node->vn_name)) {
 			return tarnode->node;
 		}
@@ -0,0 +1,47 @@
+#include <machine/cpu.h>
+
+int
+cpuid_supported(void)
+{
+	uint32_t before, after;
+
+	// The ID flag of EFLAGS can only be toggled when CPUID is available.
+	__asm__ volatile("pushfl\n\t"
+	                 "popl %0\n\t"
+	                 "movl %0, %1\n\t"
+	                 "xorl $0x200000, %1\n\t"
+	                 "pushl %1\n\t"
+	                 "popfl\n\t"
+	                 "pushfl\n\t"
+	                 "popl %1\n\t"
+	                 "pushl %0\n\t"
+	                 "popfl"
+	                 : "=&r"(before), "=&r"(after)
+	                 :
+	                 : "cc");
+	return ((before ^ after) & 0x200000) != 0;
+}
+
+void
+cpuid(uint32_t leaf,
+    uint32_t *eax,
+    uint32_t *ebx,
+    uint32_t *ecx,
+    uint32_t *edx)
+{
+	__asm__ volatile("cpuid"
+	                 : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+	                 : "a"(leaf), "c"(0));
+}
+
+uint32_t
+cpuid_features_edx(void)
+{
+	uint32_t eax, ebx, ecx, edx;
+
+	if (!cpuid_supported()) {
+		return 0;
+	}
+	cpuid(1, &eax, &ebx, &ecx, &edx);
+	return edx;
+}
@@ -0,0 +1,239 @@
+/*
+ * This file is part of NativeOS
+ * Copyright (C) 2015-2022 The NativeOS contributors
+ * SPDX-License-Identifier:  GPL-3.0-only
+ */
+
+/**
+ * \file
+ * \brief i386 implementation of memcpy and memset
+ *
+ * These replace the portable byte loops of stdkern.  The routine used for
+ * each call depends on what the processor supports, which is checked once
+ * at boot by memops_init:
+ *
+ * - Before memops_init runs, every call moves one byte at a time.
+ * - Every processor the kernel runs on, the 486 included, has the string
+ *   instructions, so rep movsd and rep stosd move the aligned middle of the
+ *   buffer a word at a time.
+ * - If CPUID reports SSE2, buffers of at least MEMOPS_SSE2_MIN bytes are
+ *   moved 64 bytes per loop with the XMM registers.  No FPU state is kept
+ *   per task, so the XMM registers that are used are saved on the stack
+ *   and restored when done.  This keeps an interrupt handler that calls
+ *   memcpy from corrupting a copy that it interrupted.
+ */
+
+#include <machine/cpu.h>
+#include <stddef.h>
+
+/** Smallest buffer worth the cost of saving the XMM registers.  */
+#define MEMOPS_SSE2_MIN 512
+
+/** Buffers shorter than this are not worth aligning first.  */
+#define MEMOPS_WORD_MIN 16
+
+#define MEMOPS_BYTES 0
+#define MEMOPS_STRING 1
+#define MEMOPS_SSE2 2
+
+/* The fastest routine available on this processor.  */
+static int memops_level = MEMOPS_BYTES;
+
+static inline void
+copy_bytes(unsigned char **dst, const unsigned char **src, size_t count)
+{
+	__asm__ volatile("rep movsb"
+	                 : "+D"(*dst), "+S"(*src), "+c"(count)
+	                 :
+	                 : "memory");
+}
+
+static inline void
+copy_words(unsigned char **dst, const unsigned char **src, size_t count)
+{
+	__asm__ volatile("rep movsl"
+	                 : "+D"(*dst), "+S"(*src), "+c"(count)
+	                 :
+	                 : "memory");
+}
+
+static inline void
+fill_bytes(unsigned char **dst, unsigned int pattern, size_t count)
+{
+	__asm__ volatile("rep stosb"
+	                 : "+D"(*dst), "+c"(count)
+	                 : "a"(pattern)
+	                 : "memory");
+}
+
+static inline void
+fill_words(unsigned char **dst, unsigned int pattern, size_t count)
+{
+	__asm__ volatile("rep stosl"
+	                 : "+D"(*dst), "+c"(count)
+	                 : "a"(pattern)
+	                 : "memory");
+}
+
+/**
+ * \brief Copy 64 byte blocks using the XMM registers.
+ *
+ * Only the stores have to be aligned, the source may be at any address.
+ *
+ * \param dst the target buffer, aligned to 16 bytes.
+ * \param src the source buffer.
+ * \param blocks the amount of 64 byte blocks to copy.
+ */
+__attribute__((target("sse2"))) static void
+copy_sse2(unsigned char *dst, const unsigned char *src, size_t blocks)
+{
+	unsigned char save[64 + 15];
+	unsigned char *regs;
+
+	regs = (unsigned char *) (((unsigned int) save + 15) & ~15);
+	__asm__ volatile("movdqa %%xmm0, 0(%3)\n\t"
+	                 "movdqa %%xmm1, 16(%3)\n\t"
+	                 "movdqa %%xmm2, 32(%3)\n\t"
+	                 "movdqa %%xmm3, 48(%3)\n"
+	                 "1:\n\t"
+	                 "movdqu 0(%1), %%xmm0\n\t"
+	                 "movdqu 16(%1), %%xmm1\n\t"
+	                 "movdqu 32(%1), %%xmm2\n\t"
+	                 "movdqu 48(%1), %%xmm3\n\t"
+	                 "movdqa %%xmm0, 0(%0)\n\t"
+	                 "movdqa %%xmm1, 16(%0)\n\t"
+	                 "movdqa %%xmm2, 32(%0)\n\t"
+	                 "movdqa %%xmm3, 48(%0)\n\t"
+	                 "addl $64, %1\n\t"
+	                 "addl $64, %0\n\t"
+	                 "decl %2\n\t"
+	                 "jnz 1b\n\t"
+	                 "movdqa 0(%3), %%xmm0\n\t"
+	                 "movdqa 16(%3), %%xmm1\n\t"
+	                 "movdqa 32(%3), %%xmm2\n\t"
+	                 "movdqa 48(%3), %%xmm3"
+	                 : "+r"(dst), "+r"(src), "+r"(blocks)
+	                 : "r"(regs)
+	                 : "cc", "memory");
+}
+
+/**
+ * \brief Fill 64 byte blocks using the XMM registers.
+ * \param dst the target buffer, aligned to 16 bytes.
+ * \param pattern the byte to fill with, repeated in the four bytes.
+ * \param blocks the amount of 64 byte blocks to fill.
+ */
+__attribute__((target("sse2"))) static void
+fill_sse2(unsigned char *dst, unsigned int pattern, size_t blocks)
+{
+	unsigned char save[16 + 15];
+	unsigned char *regs;
+
+	regs = (unsigned char *) (((unsigned int) save + 15) & ~15);
+	__asm__ volatile("movdqa %%xmm0, (%3)\n\t"
+	                 "movd %2, %%xmm0\n\t"
+	                 "pshufd $0, %%xmm0, %%xmm0\n"
+	                 "1:\n\t"
+	                 "movdqa %%xmm0, 0(%0)\n\t"
+	                 "movdqa %%xmm0, 16(%0)\n\t"
+	                 "movdqa %%xmm0, 32(%0)\n\t"
+	                 "movdqa %%xmm0, 48(%0)\n\t"
+	                 "addl $64, %0\n\t"
+	                 "decl %1\n\t"
+	                 "jnz 1b\n\t"
+	                 "movdqa (%3), %%xmm0"
+	                 : "+r"(dst), "+r"(blocks)
+	                 : "r"(pattern), "r"(regs)
+	                 : "cc", "memory");
+}
+
+void *
+memcpy(void *dst, const void *src, size_t count)
+{
+	unsigned char *pdst = (unsigned char *) dst;
+	const unsigned char *psrc = (const unsigned char *) src;
+	size_t head;
+
+	if (memops_level == MEMOPS_BYTES) {
+		while (count--) {
+			*pdst++ = *psrc++;
+		}
+		return dst;
+	}
+
+	if (memops_level == MEMOPS_SSE2 && count >= MEMOPS_SSE2_MIN) {
+		head = -(unsigned int) pdst & 15;
+		copy_bytes(&pdst, &psrc, head);
+		count -= head;
+		copy_sse2(pdst, psrc, count / 64);
+		pdst += count & ~63;
+		psrc += count & ~63;
+		count &= 63;
+	} else if (count >= MEMOPS_WORD_MIN) {
+		head = -(unsigned int) pdst & 3;
+		copy_bytes(&pdst, &psrc, head);
+		count -= head;
+		copy_words(&pdst, &psrc, count / 4);
+		count &= 3;
+	}
+	copy_bytes(&pdst, &psrc, count);
+	return dst;
+}
+
+void *
+memset(void *dest, int byte, size_t count)
+{
+	unsigned char *ptr = (unsigned char *) dest;
+	unsigned int pattern = (unsigned char) byte * 0x01010101U;
+	size_t head;
+
+	if (memops_level == MEMOPS_BYTES) {
+		while (count--) {
+			*ptr++ = byte;
+		}
+		return dest;
+	}
+
+	if (memops_level == MEMOPS_SSE2 && count >= MEMOPS_SSE2_MIN) {
+		head = -(unsigned int) ptr & 15;
+		fill_bytes(&ptr, pattern, head);
+		count -= head;
+		fill_sse2(ptr, pattern, count / 64);
+		ptr += count & ~63;
+		count &= 63;
+	} else if (count >= MEMOPS_WORD_MIN) {
+		head = -(unsigned int) ptr & 3;
+		fill_bytes(&ptr, pattern, head);
+		count -= head;
+		fill_words(&ptr, pattern, count / 4);
+		count &= 3;
+	}
+	fill_bytes(&ptr, pattern, count);
+	return dest;
+}
+
+void
+memops_init(void)
+{
+	uint32_t cr;
+
+	memops_level = MEMOPS_STRING;
+	if ((cpuid_features_edx() & (CPUID_EDX_FXSR | CPUID_EDX_SSE2))
+	    != (CPUID_EDX_FXSR | CPUID_EDX_SSE2)) {
+		return;
+	}
+
+	/*
+	 * Clear EM and TS and set MP in CR0 so that SSE instructions don't
+	 * fault, then tell the processor through CR4.OSFXSR and CR4.OSXMMEXCPT
+	 * that the kernel is ready to use them.
+	 */
+	__asm__ volatile("movl %%cr0, %0" : "=r"(cr));
+	cr = (cr & ~0xC) | 0x2;
+	__asm__ volatile("movl %0, %%cr0" : : "r"(cr));
+	__asm__ volatile("movl %%cr4, %0" : "=r"(cr));
+	cr |= 0x600;
+	__asm__ volatile("movl %0, %%cr4" : : "r"(cr));
+
+	memops_level = MEMOPS_SSE2;
+}
@@ -1,20 +1,96 @@
 #include <kernel/cpu/idt.h>
+#include <machine/cpu.h>
+#include <machine/paging.h>
+#include <sys/stdkern.h>
 
-// The page directory in use by the kernel itself.
-static unsigned int kernel_page_directory[1024] __attribute__((aligned(4096)));
+#define PAGE_PRESENT 0x01
+#define PAGE_WRITE 0x02
+#define PAGE_LARGE 0x80
+#define PAGE_GLOBAL 0x100
+
+#ifdef PAE
+// With PAE, entries are 64 bits wide, so a table only holds 512 of them.
+typedef unsigned long long pte_t;
+#define PDE_SHIFT 21
+#define PAGE_FRAME(entry) ((entry) & 0x000FFFFFFFFFF000ULL)
+#else
+typedef unsigned int pte_t;
+#define PDE_SHIFT 22
+#define PAGE_FRAME(entry) ((entry) & 0xFFFFF000)
+#endif
+
+#define TABLE_ENTRIES (PAGE_SIZE / sizeof(pte_t))
+#define PDE_INDEX(virt) ((virt) >> PDE_SHIFT)
+#define PTE_INDEX(virt) (((virt) >> 12) & (TABLE_ENTRIES - 1))
+#define LARGE_FRAME(entry) (PAGE_FRAME(entry) & ~(PAGING_LARGE_SIZE - 1))
+
+// Flags that vmm_map copies into the page table entries.
+#define VMM_PTE_FLAGS (VMM_WRITE | VMM_USER | VMM_NOCACHE)
+
+// Through the recursive slot, every page table entry of the kernel page
+// directory is visible as an element of this array, indexed by page number.
+#define VMM_PAGE_TABLES ((pte_t *) PAGING_RECURSIVE_BASE)
+
+// The page directory in use by the kernel itself.  With PAE, these are the
+// four page directories, one after the other, so they can still be indexed
+// with PDE_INDEX.
+static pte_t kernel_page_directory[1 << (32 - PDE_SHIFT)]
+    __attribute__((aligned(4096)));
+
+#ifdef PAE
+// The page directory pointer table, which points to the page directories.
+static pte_t kernel_pdpt[4] __attribute__((aligned(32)));
+#endif
+
+// PAGE_GLOBAL if the processor supports global pages, 0 otherwise.
+static unsigned int paging_global;
+
+// Non-zero once the page tables can be reached through the recursive slot.
+static int paging_recursive;
+
+extern void kernel_die(void);
 
 void
 virtual_memory_init()
 {
-	unsigned int i;
+	unsigned int i, directory;
 
-	// Mark all pages as PS=1, but they are not present.
-	for (i = 0; i < 512; i++) {
-		kernel_page_directory[i] = (i << 22) | 0x83;
+#ifdef PAE
+	if (!(cpuid_features_edx() & CPUID_EDX_PAE)) {
+		// Built for PAE, but the processor cannot do it.
+		kernel_die();
+	}
+#endif
+	if (cpuid_features_edx() & CPUID_EDX_PGE) {
+		paging_global = PAGE_GLOBAL;
 	}
-	for (i = 512; i < 1024; i++) {
-		kernel_page_directory[i] = ((i - 512) << 2) | 0x83;
+
+	// Identity map the direct map region using PS=1 pages.
+	for (i = 0; i < PDE_INDEX(PAGING_DIRECT_MAP); i++) {
+		kernel_page_directory[i] =
+		    ((pte_t) i << PDE_SHIFT) | 0x83 | paging_global;
+	}
+
+	// Page tables for the kernel windows are created on demand.
+	for (; i < PDE_INDEX(PAGING_RECURSIVE_BASE); i++) {
+		kernel_page_directory[i] = 0;
 	}
+
+	// The last slots point to the page directories themselves.
+	directory = (unsigned int) kernel_page_directory;
+	for (; i < sizeof(kernel_page_directory) / sizeof(pte_t); i++) {
+		kernel_page_directory[i] =
+		    directory | PAGE_PRESENT | PAGE_WRITE;
+		directory += PAGE_SIZE;
+	}
+
+#ifdef PAE
+	// Only the present bit is allowed in these entries.
+	for (i = 0; i < 4; i++) {
+		kernel_pdpt[i] = ((unsigned int) kernel_page_directory
+		    + i * PAGE_SIZE) | PAGE_PRESENT;
+	}
+#endif
 }
 
 void
@@ -23,15 +99,333 @@ enable_paging()
 	register unsigned int cr;
 
 	// Load the memory address of the kernel page directory.
+#ifdef PAE
+	__asm__("movl %0, %%cr3" : : "r"(kernel_pdpt));
+#else
 	__asm__("movl %0, %%cr3" : : "r"(kernel_page_directory));
+#endif
 
-	// Enable CR4 PSE
+	// Enable CR4 PSE (CR4 PAE too if enabled), and CR4 PGE if global pages
+	// are supported.
 	__asm__("movl %%cr4, %0" : "=r"(cr));
 	cr |= 0x10;
+#ifdef PAE
+	cr |= 0x20;
+#endif
+	if (paging_global) {
+		cr |= 0x80;
+	}
 	__asm__("movl %0, %%cr4" : : "r"(cr));
 
-	// Set pagination in CR0.
+	// Set pagination in CR0. WP makes read-only pages apply to the kernel
+	// too, which copy-on-write mappings depend on.
 	__asm__("movl %%cr0, %0" : "=r"(cr));
-	cr |= 0x80000001;
+	cr |= 0x80010001;
 	__asm__("movl %0, %%cr0" : : "r"(cr));
+
+	paging_recursive = 1;
+}
+
+int
+paging_enabled(void)
+{
+	unsigned int cr;
+	__asm__("movl %%cr0, %0" : "=r"(cr));
+	return (cr & 0x80000000) != 0;
+}
+
+static inline void
+invalidate_page(unsigned int virt)
+{
+	__asm__ volatile("invlpg (%0)" : : "r"(virt) : "memory");
+}
+
+// Get the page table entry for an address whose page table is present.
+static inline pte_t *
+vmm_pte(unsigned int virt)
+{
+	pte_t pde;
+
+	if (paging_recursive) {
+		return &VMM_PAGE_TABLES[virt >> 12];
+	}
+	// Before paging is enabled, physical addresses are used as is.
+	pde = kernel_page_directory[PDE_INDEX(virt)];
+	return (pte_t *) (unsigned int) PAGE_FRAME(pde) + PTE_INDEX(virt);
+}
+
+// Write an entry that the processor may be walking.  With PAE, the entry is
+// written in two halves, so it is made not present while the upper half is
+// written, and the processor never sees a mix of the old and new entries.
+static inline void
+pte_write(pte_t *entry, pte_t value)
+{
+#ifdef PAE
+	volatile unsigned int *half = (volatile unsigned int *) entry;
+
+	half[0] = 0;
+	half[1] = value >> 32;
+	half[0] = value;
+#else
+	*entry = value;
+#endif
+}
+
+// Forget every translation in the TLB, including the global ones.
+static void
+invalidate_all(void)
+{
+	unsigned int cr;
+
+	if (paging_global) {
+		// Global pages survive a CR3 reload, but not a CR4.PGE toggle.
+		__asm__ volatile("movl %%cr4, %0" : "=r"(cr));
+		__asm__ volatile("movl %0, %%cr4" : : "r"(cr & ~0x80));
+		__asm__ volatile("movl %0, %%cr4" : : "r"(cr));
+	} else {
+		__asm__ volatile("movl %%cr3, %0" : "=r"(cr));
+		__asm__ volatile("movl %0, %%cr3" : : "r"(cr) : "memory");
+	}
+}
+
+void
+vmm_gather_init(struct vmm_gather *gather)
+{
+	gather->count = 0;
+}
+
+// Record a page whose translation changed.  Past VMM_GATHER_PAGES pages,
+// only the count is kept, because the whole TLB will be flushed anyway.
+static inline void
+vmm_gather_add(struct vmm_gather *gather, unsigned int virt)
+{
+	if (gather->count < VMM_GATHER_PAGES) {
+		gather->pages[gather->count++] = virt;
+	} else {
+		gather->count = VMM_GATHER_PAGES + 1;
+	}
+}
+
+void
+vmm_gather_flush(struct vmm_gather *gather)
+{
+	unsigned int i;
+
+	if (gather->count > VMM_GATHER_PAGES) {
+		invalidate_all();
+	} else {
+		for (i = 0; i < gather->count; i++) {
+			invalidate_page(gather->pages[i]);
+		}
+	}
+	gather->count = 0;
+}
+
+// Replace a large page of a kernel window with a page table that maps the
+// same frames, so that single pages inside of it can be changed.
+static int
+vmm_split(unsigned int virt)
+{
+	pte_t *pde, *table, large;
+	physaddr_t frame;
+	unsigned int i;
+
+	frame = pmm_alloc_page(PMM_ZONE_NORMAL, PMM_OWNER_PAGING);
+	if (frame == 0) {
+		return -1;
+	}
+	pde = &kernel_page_directory[PDE_INDEX(virt)];
+	large = *pde;
+	virt &= ~(PAGING_LARGE_SIZE - 1);
+
+	// Fill the new table through the direct map before it is installed,
+	// so that the region never goes through half-built translations.
+	table = (pte_t *) (unsigned int) frame;
+	for (i = 0; i < TABLE_ENTRIES; i++) {
+		pte_write(&table[i],
+		    (LARGE_FRAME(large) + ((pte_t) i << 12))
+		    | (large & (PAGE_PRESENT | VMM_PTE_FLAGS | PAGE_GLOBAL)));
+	}
+
+	pte_write(pde, frame | PAGE_PRESENT | PAGE_WRITE | (large & VMM_USER));
+	if (paging_recursive) {
+		invalidate_page((unsigned int) vmm_pte(virt));
+	}
+	invalidate_page(virt);
+	return 0;
+}
+
+int
+vmm_map(unsigned int virt, physaddr_t phys, unsigned int flags)
+{
+	pte_t *pde, *table;
+	physaddr_t frame;
+
+	pde = &kernel_page_directory[PDE_INDEX(virt)];
+	if (virt >= PAGING_RECURSIVE_BASE) {
+		// The page tables window cannot be remapped.
+		return -1;
+	}
+	if (*pde & PAGE_LARGE) {
+		if (virt < PAGING_DIRECT_MAP) {
+			// Part of the direct map, cannot remap this address.
+			return -1;
+		}
+		if (vmm_split(virt) != 0) {
+			return -1;
+		}
+	}
+	if (!(*pde & PAGE_PRESENT)) {
+		frame =
+		    pmm_alloc_zeroed_page(PMM_ZONE_NORMAL, PMM_OWNER_PAGING);
+		if (frame == 0) {
+			return -1;
+		}
+		*pde = frame | PAGE_PRESENT | PAGE_WRITE | (flags & VMM_USER);
+
+		// Forget any stale translation of the window for the new table.
+		if (paging_recursive) {
+			table = vmm_pte(virt & ~(PAGING_LARGE_SIZE - 1));
+			invalidate_page((unsigned int) table);
+		}
+	}
+
+	if (!(flags & VMM_USER)) {
+		flags |= paging_global;
+	}
+	pte_write(vmm_pte(virt), PAGE_FRAME(phys) | PAGE_PRESENT
+	    | (flags & (VMM_PTE_FLAGS | PAGE_GLOBAL)));
+	invalidate_page(virt);
+	return 0;
+}
+
+physaddr_t
+vmm_unmap(unsigned int virt)
+{
+	struct vmm_gather gather;
+	physaddr_t phys;
+
+	vmm_gather_init(&gather);
+	phys = vmm_unmap_gather(virt, &gather);
+	vmm_gather_flush(&gather);
+	return phys;
+}
+
+physaddr_t
+vmm_unmap_gather(unsigned int virt, struct vmm_gather *gather)
+{
+	pte_t *pte, pde;
+	physaddr_t phys;
+
+	pde = kernel_page_directory[PDE_INDEX(virt)];
+	if (!(pde & PAGE_PRESENT) || virt < PAGING_DIRECT_MAP
+	    || virt >= PAGING_RECURSIVE_BASE) {
+		return 0;
+	}
+	if ((pde & PAGE_LARGE) && vmm_split(virt) != 0) {
+		return 0;
+	}
+
+	pte = vmm_pte(virt);
+	if (!(*pte & PAGE_PRESENT)) {
+		return 0;
+	}
+	phys = PAGE_FRAME(*pte);
+	pte_write(pte, 0);
+	vmm_gather_add(gather, virt);
+	return phys;
+}
+
+int
+vmm_map_range(unsigned int virt,
+    physaddr_t phys,
+    unsigned int size,
+    unsigned int flags)
+{
+	unsigned int end = virt + size, global, page;
+	struct vmm_gather gather;
+	physaddr_t table;
+	pte_t *pde;
+
+	global = (flags & VMM_USER) ? 0 : paging_global;
+	while (virt < end) {
+		pde = &kernel_page_directory[PDE_INDEX(virt)];
+		if (((virt | phys) & (PAGING_LARGE_SIZE - 1)) != 0
+		    || end - virt < PAGING_LARGE_SIZE
+		    || virt < PAGING_DIRECT_MAP
+		    || virt >= PAGING_RECURSIVE_BASE) {
+			if (vmm_map(virt, phys, flags) != 0) {
+				return -1;
+			}
+			virt += PAGE_SIZE;
+			phys += PAGE_SIZE;
+			continue;
+		}
+
+		// The whole page table is replaced by a large page.
+		table = (*pde & (PAGE_PRESENT | PAGE_LARGE)) == PAGE_PRESENT
+		    ? PAGE_FRAME(*pde)
+		    : 0;
+		pte_write(pde, phys | PAGE_PRESENT | PAGE_LARGE
+		    | ((flags | global) & (VMM_PTE_FLAGS | PAGE_GLOBAL)));
+		if (table) {
+			// Drop the cached table before the frame is reused.
+			vmm_gather_init(&gather);
+			for (page = 0; page < PAGING_LARGE_SIZE;
+			     page += PAGE_SIZE) {
+				vmm_gather_add(&gather, virt + page);
+			}
+			vmm_gather_flush(&gather);
+			pmm_free_page(table);
+		} else {
+			invalidate_page(virt);
+		}
+		virt += PAGING_LARGE_SIZE;
+		phys += PAGING_LARGE_SIZE;
+	}
+	return 0;
+}
+
+void
+vmm_unmap_range(unsigned int virt, unsigned int size)
+{
+	unsigned int end = virt + size;
+	struct vmm_gather gather;
+	pte_t *pde;
+
+	vmm_gather_init(&gather);
+	while (virt < end) {
+		pde = &kernel_page_directory[PDE_INDEX(virt)];
+		if ((*pde & PAGE_LARGE) && virt >= PAGING_DIRECT_MAP
+		    && (virt & (PAGING_LARGE_SIZE - 1)) == 0
+		    && end - virt >= PAGING_LARGE_SIZE) {
+			// A single invlpg drops the whole large page.
+			pte_write(pde, 0);
+			vmm_gather_add(&gather, virt);
+			virt += PAGING_LARGE_SIZE;
+		} else {
+			vmm_unmap_gather(virt, &gather);
+			virt += PAGE_SIZE;
+		}
+	}
+	vmm_gather_flush(&gather);
+}
+
+physaddr_t
+vmm_translate(unsigned int virt)
+{
+	pte_t pde, pte;
+
+	pde = kernel_page_directory[PDE_INDEX(virt)];
+	if (!(pde & PAGE_PRESENT)) {
+		return 0;
+	}
+	if (pde & PAGE_LARGE) {
+		return LARGE_FRAME(pde) | (virt & (PAGING_LARGE_SIZE - 1));
+	}
+	pte = *vmm_pte(virt);
+	if (!(pte & PAGE_PRESENT)) {
+		return 0;
+	}
+	return PAGE_FRAME(pte) | (virt & 0xFFF);
 }
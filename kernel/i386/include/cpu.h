@@ -7,4 +7,27 @@ void port_out_word(uint16_t port, uint16_t value);
 void port_out_long(uint16_t port, uint32_t value);
 uint8_t port_in_byte(uint16_t port);
 uint16_t port_in_word(uint16_t port);
-uint32_t port_in_long(uint16_t port);
\ No newline at end of file
+uint32_t port_in_long(uint16_t port);
+
+/* Feature bits reported in EDX by CPUID leaf 1.  */
+#define CPUID_EDX_PSE (1 << 3)
+#define CPUID_EDX_PAE (1 << 6)
+#define CPUID_EDX_PGE (1 << 13)
+#define CPUID_EDX_FXSR (1 << 24)
+#define CPUID_EDX_SSE2 (1 << 26)
+
+/* Test whether the processor implements the CPUID instruction.  */
+int cpuid_supported(void);
+
+/* Run the CPUID instruction for the given leaf.  */
+void cpuid(uint32_t leaf,
+    uint32_t *eax,
+    uint32_t *ebx,
+    uint32_t *ecx,
+    uint32_t *edx);
+
+/* Get the EDX feature bits of CPUID leaf 1, or 0 if CPUID is missing.  */
+uint32_t cpuid_features_edx(void);
+
+/* Pick the fastest memcpy and memset for this processor.  */
+void memops_init(void);
@@ -1,5 +1,170 @@
 #pragma once
 
+#include <kernel/mem/pmm.h>
+
+/**
+ * Physical memory below this address is identity mapped by the kernel page
+ * directory, so it can be accessed using the physical address as a pointer.
+ * The virtual memory above this address is used by kernel windows that are
+ * populated with 4 KB pages on demand, such as the kernel heap.
+ */
+#define PAGING_DIRECT_MAP 0x80000000
+
+#ifdef PAE
+/**
+ * The last four slots of the kernel page directories point to the four page
+ * directories themselves, so the page tables are visible in the last 8 MB
+ * of the virtual memory: the 64 bit page table entry for a virtual address
+ * is found at index (address >> 12) of an array starting at this address.
+ * Kernel windows end before this address.
+ */
+#define PAGING_RECURSIVE_BASE 0xFF800000
+#else
+/**
+ * The last slot of the kernel page directory points to the page directory
+ * itself, so the page tables are visible in the last 4 MB of the virtual
+ * memory: the page table entry for a virtual address is found at index
+ * (address >> 12) of an array starting at this address, and the page
+ * directory is the last page.  Kernel windows end before this address.
+ */
+#define PAGING_RECURSIVE_BASE 0xFFC00000
+#endif
+
+/** Size of a page. */
+#define PAGE_SIZE 0x1000
+
+/** Size of a large page, mapped by a single page directory entry. */
+#ifdef PAE
+#define PAGING_LARGE_SIZE 0x200000
+#else
+#define PAGING_LARGE_SIZE 0x400000
+#endif
+
+/**
+ * Amount of pages a TLB gather invalidates one by one.  When more pages are
+ * changed, the whole TLB is flushed instead.
+ */
+#define VMM_GATHER_PAGES 32
+
+/**
+ * \brief TLB gather
+ *
+ * A gather collects the virtual addresses whose translations are changed
+ * during an operation, so that the TLB is flushed once at the end of the
+ * operation instead of once per page.  Up to VMM_GATHER_PAGES pages are
+ * invalidated with invlpg, which keeps the rest of the TLB warm.  Bigger
+ * operations flush the whole TLB, which costs the same no matter how many
+ * pages were changed.
+ */
+struct vmm_gather {
+	unsigned int count;
+	unsigned int pages[VMM_GATHER_PAGES];
+};
+
+/* Flags for vmm_map.  */
+#define VMM_WRITE 0x002   /**< The page can be written.  */
+#define VMM_USER 0x004    /**< The page can be accessed from ring 3.  */
+#define VMM_NOCACHE 0x010 /**< Disable caching, for device memory.  */
+
 void virtual_memory_init(void);
 
 void enable_paging();
+
+/**
+ * \brief Test whether paging has been enabled.
+ * \return non-zero if paging is enabled, zero otherwise.
+ */
+int paging_enabled(void);
+
+/**
+ * \brief Map a 4 KB page into the kernel page directory.
+ *
+ * The virtual address must be above PAGING_DIRECT_MAP.  If there is no page
+ * table for the given address, a page frame is requested to the physical
+ * memory manager to hold it.  Pages that are not mapped with VMM_USER are
+ * marked as global when the processor supports it, so that they are kept
+ * in the TLB when CR3 is reloaded.
+ *
+ * \param virt the virtual address of the page to map.
+ * \param phys the physical address of the page frame to map there.
+ * \param flags a combination of the VMM flags.
+ * \return zero on success, non-zero if the page could not be mapped.
+ */
+int vmm_map(unsigned int virt, physaddr_t phys, unsigned int flags);
+
+/**
+ * \brief Unmap a 4 KB page from the kernel page directory.
+ * \param virt the virtual address of the page to unmap.
+ * \return the physical address of the page frame that was mapped there, or
+ *         0 if the page was not mapped.
+ */
+physaddr_t vmm_unmap(unsigned int virt);
+
+/**
+ * \brief Start a TLB gather.
+ * \param gather the gather to initialise.
+ */
+void vmm_gather_init(struct vmm_gather *gather);
+
+/**
+ * \brief Unmap a 4 KB page, deferring the TLB invalidation to a gather.
+ *
+ * The old translation may still be used until vmm_gather_flush is called,
+ * so the page must not be accessed, and it must not be mapped again using
+ * anything else than vmm_map, until then.
+ *
+ * \param virt the virtual address of the page to unmap.
+ * \param gather the gather that records the page.
+ * \return the physical address of the page frame that was mapped there, or
+ *         0 if the page was not mapped.
+ */
+physaddr_t vmm_unmap_gather(unsigned int virt, struct vmm_gather *gather);
+
+/**
+ * \brief Invalidate every page recorded in a TLB gather.
+ *
+ * The gather is emptied, so it can be used again.
+ *
+ * \param gather the gather to flush.
+ */
+void vmm_gather_flush(struct vmm_gather *gather);
+
+/**
+ * \brief Map a physically contiguous region into the kernel page directory.
+ *
+ * Every block of PAGING_LARGE_SIZE bytes (4 MB, or 2 MB with PAE) of the
+ * region whose virtual and physical addresses are both aligned to that size
+ * is mapped with a single large page, so that walking the region only takes
+ * one TLB entry per block.  Any page table that was in use for such a block
+ * is released.  The rest of the region is mapped with
+ * 4 KB pages.  Large pages are split back into a page table when a single
+ * page inside of them is mapped or unmapped later.
+ *
+ * \param virt the virtual address of the region, aligned to a page.
+ * \param phys the physical address of the region, aligned to a page.
+ * \param size the size of the region, a multiple of the page size.
+ * \param flags a combination of the VMM flags.
+ * \return zero on success, non-zero if the region could not be mapped.  In
+ *         that case, part of the region may have been mapped.
+ */
+int vmm_map_range(unsigned int virt,
+    physaddr_t phys,
+    unsigned int size,
+    unsigned int flags);
+
+/**
+ * \brief Unmap a region from the kernel page directory.
+ *
+ * The page frames that were mapped in the region are not released.
+ *
+ * \param virt the virtual address of the region, aligned to a page.
+ * \param size the size of the region, a multiple of the page size.
+ */
+void vmm_unmap_range(unsigned int virt, unsigned int size);
+
+/**
+ * \brief Get the physical address a virtual address is mapped to.
+ * \param virt the virtual address.
+ * \return the physical address, or 0 if the address is not mapped.
+ */
+physaddr_t vmm_translate(unsigned int virt);
@@ -85,7 +85,7 @@ device_install(device_t *dev, char *mtname)
 	vfs_node_t *node;
 	if ((node = devfs_finddir(0, mtname)) != 0)
 		return -2; /* node name is taken. */
-	if ((node = (vfs_node_t *) malloc(sizeof(vfs_node_t))) == 0)
+	if ((node = vfs_node_alloc()) == 0)
 		return -1; /* cannot allocate. */
 	strncpy(node->vn_name, mtname, 64);
 	node->vn_flags = 0;
@@ -110,7 +110,7 @@ device_remove(char *mtname)
 	vfs_node_t *node = devfs_finddir(0, mtname);
 	if (node) {
 		list_delete(devmgr_list, node);
-		free(node);
+		vfs_node_free(node);
 	}
 }
 
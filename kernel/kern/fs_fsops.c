@@ -97,3 +97,15 @@ fs_finddir(vfs_node_t *node, char *name)
 	}
 	return 0;
 }
+
+const void *
+fs_mmap(vfs_node_t *node, unsigned int *size)
+{
+	vfs_ops_t *ops = NODE_OPS(node);
+	if (ops && ops->vfs_mmap) {
+		if (node->vn_flags == VN_FREGFILE) {
+			return ops->vfs_mmap(node, size);
+		}
+	}
+	return 0;
+}
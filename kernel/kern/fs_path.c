@@ -1,6 +1,10 @@
+#include <sys/arena.h>
 #include <sys/stdkern.h>
 #include <sys/vfs.h>
 
+/** Paths up to this length are resolved without using the heap. */
+#define FS_PATH_SCRATCH 128
+
 /**
  * Recursively locate the given path in the given directory VFS node. If
  * the path points to a file name, such as "hello.txt", it will lookup for
@@ -36,15 +40,20 @@ vfs_node_t *
 fs_resolve(const char *path)
 {
 	vfs_node_t *descriptor = 0;
-	char *strsep_orig, *strsep_in, *strsep_out;
+	char *strsep_in, *strsep_out;
+	char scratch[FS_PATH_SCRATCH];
+	arena_t arena;
 
 	/*
 	 * We do not want strsep to modify the given path parameter, so we
-	 * duplicate it. Also, we inmediately keep an _orig reference to do
-	 * the free. strsep will be modifying _in value.
+	 * duplicate it. The copy is made in an arena backed by the stack, so
+	 * it goes away when the arena is destroyed. strsep will be modifying
+	 * _in value.
 	 */
-	strsep_orig = strdup(path);
-	strsep_in = strsep_orig;
+	arena_init(&arena, scratch, sizeof(scratch));
+	if ((strsep_in = arena_strdup(&arena, path)) == 0) {
+		goto defer;
+	}
 
 	/* Strip the volume separator and try to lookup the proper volume. */
 	strsep_out = strsep(&strsep_in, ":");
@@ -69,6 +78,6 @@ fs_resolve(const char *path)
 	}
 
 defer:
-	free(strsep_orig);
+	arena_destroy(&arena);
 	return descriptor;
 }
@@ -1,9 +1,11 @@
+#include <sys/kmem.h>
 #include <sys/list.h>
 #include <sys/stdkern.h>
 #include <sys/vfs.h>
 
 static list_t *vfs_volumes;
 static list_t *vfs_drivers;
+static kmem_cache_t *vfs_nodes_cache;
 
 static int rootfs_mount(vfs_volume_t *vol);
 static int rootfs_open(struct vfs_node *node, unsigned int flags);
@@ -63,12 +65,33 @@ find_mountpoint_by_name(char *mtname)
 	return 0;
 }
 
+static void
+vfs_node_ctor(void *node)
+{
+	memset(node, 0, sizeof(vfs_node_t));
+}
+
+vfs_node_t *
+vfs_node_alloc(void)
+{
+	return (vfs_node_t *) kmem_cache_alloc(vfs_nodes_cache);
+}
+
+void
+vfs_node_free(vfs_node_t *node)
+{
+	kmem_cache_free(vfs_nodes_cache, node);
+}
+
 void
 vfs_init(void)
 {
 	extern char fs_descriptor__start, fs_descriptor__end;
 	vfs_filesys_t **fs_start, **fs_end, **fs;
 
+	vfs_nodes_cache = kmem_cache_create("vfs_node",
+	                                    sizeof(vfs_node_t),
+	                                    &vfs_node_ctor);
 	vfs_volumes = list_alloc();
 	vfs_drivers = list_alloc();
 
@@ -165,7 +188,7 @@ rootfs_register_volume(vfs_volume_t *vol)
 {
 	vfs_node_t *mati_stop_using_haskell;
 
-	mati_stop_using_haskell = (vfs_node_t *) malloc(sizeof(vfs_node_t));
+	mati_stop_using_haskell = vfs_node_alloc();
 	strcpy(mati_stop_using_haskell->vn_name, vol->vv_name);
 	mati_stop_using_haskell->vn_flags = VN_FREGFILE;
 	mati_stop_using_haskell->vn_volume = rootfs_root.vn_volume;
@@ -4,9 +4,10 @@
  * SPDX-License-Identifier:  GPL-3.0-only
  */
 
-#include <i386/include/paging.h>
+#include <kernel/mem/pmm.h>
 #include <machine/multiboot.h>
 #include <sys/device.h>
+#include <sys/kprintf.h>
 #include <sys/stdkern.h>
 #include <sys/vfs.h>
 
@@ -37,7 +38,6 @@ kernel_main(void)
 	vfs_init();
 	device_init();
 	ramdisk_init();
-	enable_paging();
 	kernel_welcome();
 }
 
@@ -47,15 +47,22 @@ ramdisk_init(void)
 	unsigned int i;
 	multiboot_module_t *multiboot_mods;
 	unsigned char *tar;
+	int mounted = 0;
 
 	multiboot_mods = (multiboot_module_t *) multiboot_info->mods_addr;
 	for (i = 0; i < multiboot_info->mods_count; i++) {
 		/* We can afford to strcmp because "ramdisk" is static. */
-		if (!strcmp("ramdisk", (char *) multiboot_mods[0].string)) {
+		if (!mounted
+		    && !strcmp("ramdisk", (char *) multiboot_mods[i].string)) {
 			/* We found the ramdisk. */
 			tar = (unsigned char *) multiboot_mods[i].mod_start;
 			vfs_mount("tarfs", "INITRD", tar);
-			return;
+			mounted = 1;
+		} else {
+			/* Nobody is going to read this module. */
+			pmm_reclaim(multiboot_mods[i].mod_start,
+			            multiboot_mods[i].mod_end,
+			            PMM_OWNER_MODULE);
 		}
 	}
 }
@@ -72,12 +79,6 @@ fs_resolve_and_open(const char *path, unsigned int args)
 	return node;
 }
 
-static unsigned int
-fs_write_string(vfs_node_t *node, unsigned int offt, const char *str)
-{
-	return fs_write(node, offt, (unsigned char *) str, strlen(str));
-}
-
 static void
 kernel_welcome(void)
 {
@@ -86,6 +87,7 @@ kernel_welcome(void)
 	char buffer[64];
 
 	vtcon = fs_resolve_and_open("DEV:/vtcon", VO_FWRITE);
+	kprintf_attach(vtcon);
 
 	motd = fs_resolve_and_open("INITRD:/SYSTEM/MOTD.TXT", VO_FREAD);
 	if (motd) {
@@ -94,10 +96,13 @@ kernel_welcome(void)
 			fs_write(vtcon, 0, buffer, read);
 			offt += read;
 		}
-		fs_write_string(vtcon, 0, "\n");
+		kprintf("\n");
 		fs_close(motd);
 	}
 	for (;;) {
 		fs_read(vtcon, 0, buffer, 64);
+
+		/* Use the spare time to zero pages in advance. */
+		pmm_refill_zeroed();
 	}
 }
@@ -0,0 +1,84 @@
+/*
+ * This file is part of NativeOS
+ * Copyright (C) 2015-2022 The NativeOS contributors
+ * SPDX-License-Identifier:  GPL-3.0-only
+ */
+
+/**
+ * \file kern/kern_printf.c
+ * \brief Buffered sinks for the formatting engine
+ */
+
+#include <sys/kprintf.h>
+
+/* The node where kprintf writes to.  */
+static vfs_node_t *kprintf_node = 0;
+
+static void
+ksink_put(void *ctx, char ch)
+{
+	struct ksink *sink = (struct ksink *) ctx;
+
+	sink->buf[sink->len++] = ch;
+	if (ch == '\n' || sink->len == KSINK_SIZE) {
+		ksink_flush(sink);
+	}
+}
+
+void
+ksink_init(struct ksink *sink, vfs_node_t *node)
+{
+	sink->node = node;
+	sink->offset = 0;
+	sink->len = 0;
+}
+
+void
+ksink_flush(struct ksink *sink)
+{
+	if (sink->len && sink->node) {
+		fs_write(sink->node, sink->offset, sink->buf, sink->len);
+		sink->offset += sink->len;
+	}
+	sink->len = 0;
+}
+
+int
+ksink_vprintf(struct ksink *sink, const char *fmt, va_list args)
+{
+	return kformat(&ksink_put, sink, fmt, args);
+}
+
+int
+ksink_printf(struct ksink *sink, const char *fmt, ...)
+{
+	va_list args;
+	int len;
+
+	va_start(args, fmt);
+	len = ksink_vprintf(sink, fmt, args);
+	va_end(args);
+	return len;
+}
+
+void
+kprintf_attach(vfs_node_t *node)
+{
+	kprintf_node = node;
+}
+
+int
+kprintf(const char *fmt, ...)
+{
+	struct ksink sink;
+	va_list args;
+	int len;
+
+	/* A sink of its own keeps concurrent calls from mixing their text. */
+	ksink_init(&sink, kprintf_node);
+	va_start(args, fmt);
+	len = ksink_vprintf(&sink, fmt, args);
+	va_end(args);
+	ksink_flush(&sink);
+	return len;
+}
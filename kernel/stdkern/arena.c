@@ -0,0 +1,123 @@
+/*
+ * This file is part of NativeOS
+ * Copyright (C) 2015-2022 The NativeOS contributors
+ * SPDX-License-Identifier:  GPL-3.0-only
+ */
+
+#include <sys/arena.h>
+#include <sys/stdkern.h>
+
+/** Allocations are always a multiple of this amount of bytes. */
+#define ARENA_ALIGN sizeof(void *)
+
+/** Minimum size of the chunks requested to the heap. */
+#define ARENA_CHUNK_SIZE 1024
+
+/**
+ * Header of the chunks requested to the heap once the first buffer of the
+ * arena is full. The chunk buffer comes right after the header.
+ */
+struct arena_chunk {
+	struct arena_chunk *next;
+};
+
+void
+arena_init(arena_t *arena, void *buf, size_t size)
+{
+	arena->base = arena->first = (unsigned char *) buf;
+	arena->size = arena->first_size = size;
+	arena->used = 0;
+	arena->owned = 0;
+	arena->chunks = 0;
+}
+
+int
+arena_create(arena_t *arena, size_t size)
+{
+	void *buf;
+
+	if ((buf = malloc(size)) == 0) {
+		return -1;
+	}
+	arena_init(arena, buf, size);
+	arena->owned = 1;
+	return 0;
+}
+
+/**
+ * \brief Request a new chunk to the heap to continue allocating from it.
+ * \param arena the arena that is full.
+ * \param size the size of the allocation that did not fit.
+ * \return 0 if the arena has a new chunk, -1 if there is no memory.
+ */
+static int
+arena_grow(arena_t *arena, size_t size)
+{
+	struct arena_chunk *chunk;
+
+	if (size < ARENA_CHUNK_SIZE) {
+		size = ARENA_CHUNK_SIZE;
+	}
+	chunk = (struct arena_chunk *) malloc(sizeof(*chunk) + size);
+	if (!chunk) {
+		return -1;
+	}
+	chunk->next = arena->chunks;
+	arena->chunks = chunk;
+	arena->base = (unsigned char *) (chunk + 1);
+	arena->size = size;
+	arena->used = 0;
+	return 0;
+}
+
+void *
+arena_alloc(arena_t *arena, size_t size)
+{
+	void *ptr;
+
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+	if (size > arena->size - arena->used && arena_grow(arena, size) < 0) {
+		return 0;
+	}
+	ptr = arena->base + arena->used;
+	arena->used += size;
+	return ptr;
+}
+
+char *
+arena_strdup(arena_t *arena, const char *str)
+{
+	char *copy;
+
+	if ((copy = arena_alloc(arena, strlen(str) + 1)) != 0) {
+		strcpy(copy, str);
+	}
+	return copy;
+}
+
+void
+arena_reset(arena_t *arena)
+{
+	struct arena_chunk *next;
+
+	while (arena->chunks) {
+		next = arena->chunks->next;
+		free(arena->chunks);
+		arena->chunks = next;
+	}
+	arena->base = arena->first;
+	arena->size = arena->first_size;
+	arena->used = 0;
+}
+
+void
+arena_destroy(arena_t *arena)
+{
+	arena_reset(arena);
+	if (arena->owned) {
+		free(arena->first);
+	}
+	arena->base = arena->first = 0;
+	arena->size = arena->first_size = 0;
+	arena->owned = 0;
+}
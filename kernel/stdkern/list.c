@@ -4,9 +4,13 @@
  * SPDX-License-Identifier:  GPL-3.0-only
  */
 
+#include <sys/kmem.h>
 #include <sys/list.h>
 #include <sys/stdkern.h>
 
+/* List nodes are allocated from their own object cache.  */
+static kmem_cache_t *listnode_cache;
+
 static inline void
 chain(listnode_t *car, listnode_t *cdr)
 {
@@ -19,7 +23,17 @@ chain(listnode_t *car, listnode_t *cdr)
 static listnode_t *
 listnode_alloc(void *ptr)
 {
-	listnode_t *node = (listnode_t *) malloc(sizeof(listnode_t));
+	listnode_t *node;
+
+	if (!listnode_cache) {
+		listnode_cache = kmem_cache_create("listnode",
+		                                   sizeof(listnode_t),
+		                                   0);
+	}
+	if (!listnode_cache) {
+		return NULL;
+	}
+	node = (listnode_t *) kmem_cache_alloc(listnode_cache);
 	if (node) {
 		node->prev = NULL;
 		node->next = NULL;
@@ -35,7 +49,7 @@ listnode_free(listnode_t *node)
 	node->prev = NULL;
 	node->next = NULL;
 	node->data = NULL;
-	free(node);
+	kmem_cache_free(listnode_cache, node);
 	return ptr;
 }
 
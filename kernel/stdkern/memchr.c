@@ -0,0 +1,39 @@
+/*
+ * This file is part of NativeOS
+ * Copyright (C) 2015-2022 The NativeOS contributors
+ * SPDX-License-Identifier:  GPL-3.0-only
+ */
+
+#include <stddef.h>
+
+#include "strword.h"
+
+void *
+memchr(const void *s, int c, size_t count)
+{
+	const unsigned char *ptr = (const unsigned char *) s;
+	const word_t *word;
+	word_t pattern = WORD_REPEAT(c);
+
+	while (count && !WORD_ALIGNED(ptr)) {
+		if (*ptr == (unsigned char) c) {
+			return (void *) ptr;
+		}
+		ptr++;
+		count--;
+	}
+
+	/* Skip the words that don't have the byte. */
+	word = (const word_t *) ptr;
+	while (count >= WORD_SIZE && !WORD_HAS_ZERO(*word ^ pattern)) {
+		word++;
+		count -= WORD_SIZE;
+	}
+
+	for (ptr = (const unsigned char *) word; count; count--, ptr++) {
+		if (*ptr == (unsigned char) c) {
+			return (void *) ptr;
+		}
+	}
+	return 0;
+}
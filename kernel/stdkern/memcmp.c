@@ -0,0 +1,46 @@
+/*
+ * This file is part of NativeOS
+ * Copyright (C) 2015-2022 The NativeOS contributors
+ * SPDX-License-Identifier:  GPL-3.0-only
+ */
+
+#include <stddef.h>
+
+#include "strword.h"
+
+int
+memcmp(const void *s1, const void *s2, size_t count)
+{
+	const unsigned char *cmp1 = (const unsigned char *) s1;
+	const unsigned char *cmp2 = (const unsigned char *) s2;
+	const word_t *w1, *w2;
+
+	/* Words can only be compared if both buffers are equally aligned. */
+	if (WORD_ALIGNED(cmp1 - cmp2)) {
+		while (count && !WORD_ALIGNED(cmp1)) {
+			if (*cmp1 != *cmp2) {
+				return *cmp1 - *cmp2;
+			}
+			cmp1++;
+			cmp2++;
+			count--;
+		}
+		w1 = (const word_t *) cmp1;
+		w2 = (const word_t *) cmp2;
+		while (count >= WORD_SIZE && *w1 == *w2) {
+			w1++;
+			w2++;
+			count -= WORD_SIZE;
+		}
+		cmp1 = (const unsigned char *) w1;
+		cmp2 = (const unsigned char *) w2;
+	}
+
+	/* Locate the first different byte, if any. */
+	for (; count; count--, cmp1++, cmp2++) {
+		if (*cmp1 != *cmp2) {
+			return *cmp1 - *cmp2;
+		}
+	}
+	return 0;
+}
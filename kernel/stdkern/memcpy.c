@@ -18,7 +18,8 @@
 
 #include <stddef.h>
 
-void *
+/* Portable version, architectures may provide a faster one.  */
+__attribute__((weak)) void *
 memcpy(void *dst, const void *src, size_t count)
 {
 	unsigned char *pdst = (unsigned char *) dst;
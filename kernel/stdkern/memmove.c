@@ -0,0 +1,59 @@
+/*
+ * This file is part of NativeOS
+ * Copyright (C) 2015-2022 The NativeOS contributors
+ * SPDX-License-Identifier:  GPL-3.0-only
+ */
+
+#include <stddef.h>
+
+#include "strword.h"
+
+void *
+memmove(void *dst, const void *src, size_t count)
+{
+	unsigned char *pdst = (unsigned char *) dst;
+	const unsigned char *psrc = (const unsigned char *) src;
+	word_t *wdst;
+	const word_t *wsrc;
+
+	if (pdst <= psrc || pdst >= psrc + count) {
+		/* A forward copy never reads bytes that it already wrote. */
+		if (WORD_ALIGNED(pdst - psrc)) {
+			while (count && !WORD_ALIGNED(pdst)) {
+				*pdst++ = *psrc++;
+				count--;
+			}
+			wdst = (word_t *) pdst;
+			wsrc = (const word_t *) psrc;
+			for (; count >= WORD_SIZE; count -= WORD_SIZE) {
+				*wdst++ = *wsrc++;
+			}
+			pdst = (unsigned char *) wdst;
+			psrc = (const unsigned char *) wsrc;
+		}
+		while (count--) {
+			*pdst++ = *psrc++;
+		}
+	} else {
+		/* The end of src is overwritten, so copy from the end. */
+		pdst += count;
+		psrc += count;
+		if (WORD_ALIGNED(pdst - psrc)) {
+			while (count && !WORD_ALIGNED(pdst)) {
+				*--pdst = *--psrc;
+				count--;
+			}
+			wdst = (word_t *) pdst;
+			wsrc = (const word_t *) psrc;
+			for (; count >= WORD_SIZE; count -= WORD_SIZE) {
+				*--wdst = *--wsrc;
+			}
+			pdst = (unsigned char *) wdst;
+			psrc = (const unsigned char *) wsrc;
+		}
+		while (count--) {
+			*--pdst = *--psrc;
+		}
+	}
+	return dst;
+}
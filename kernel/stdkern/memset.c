@@ -1,6 +1,7 @@
 #include <stddef.h>
 
-void *
+/* Portable version, architectures may provide a faster one.  */
+__attribute__((weak)) void *
 memset(void *dest, int byte, size_t count)
 {
 	unsigned char *ptr = (unsigned char *) dest;
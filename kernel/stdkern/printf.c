@@ -0,0 +1,251 @@
+/*
+ * This file is part of NativeOS
+ * Copyright (C) 2015-2022 The NativeOS contributors
+ * SPDX-License-Identifier:  GPL-3.0-only
+ */
+
+#include <sys/kprintf.h>
+
+#define FORMAT_LEFT 0x1
+#define FORMAT_ZERO 0x2
+
+struct format_spec {
+	unsigned int flags;
+	unsigned int width;
+	int precision; /* -1 if there is no precision. */
+};
+
+struct format_buffer {
+	char *buf;
+	size_t size;
+	size_t len;
+};
+
+static const char format_lower[] = "0123456789abcdef";
+static const char format_upper[] = "0123456789ABCDEF";
+
+static void
+format_pad(kformat_put_t put, void *ctx, char ch, unsigned int count)
+{
+	while (count--) {
+		put(ctx, ch);
+	}
+}
+
+/**
+ * \brief Emit a converted value, padded up to the field width.
+ * \param prefix a sign or base prefix that goes before the zero padding.
+ * \param str the converted value.
+ * \param len the length of the converted value.
+ * \return the amount of characters emitted.
+ */
+static unsigned int
+format_emit(kformat_put_t put,
+    void *ctx,
+    const struct format_spec *spec,
+    const char *prefix,
+    const char *str,
+    unsigned int len)
+{
+	unsigned int total, pad = 0, i;
+
+	total = len;
+	for (i = 0; prefix[i]; i++) {
+		total++;
+	}
+	if (spec->width > total) {
+		pad = spec->width - total;
+	}
+
+	if (!(spec->flags & (FORMAT_LEFT | FORMAT_ZERO))) {
+		format_pad(put, ctx, ' ', pad);
+	}
+	while (*prefix) {
+		put(ctx, *prefix++);
+	}
+	if ((spec->flags & (FORMAT_LEFT | FORMAT_ZERO)) == FORMAT_ZERO) {
+		format_pad(put, ctx, '0', pad);
+	}
+	for (i = 0; i < len; i++) {
+		put(ctx, str[i]);
+	}
+	if (spec->flags & FORMAT_LEFT) {
+		format_pad(put, ctx, ' ', pad);
+	}
+	return total + pad;
+}
+
+/* Parse a decimal number in the format string, if there is one. */
+static unsigned int
+format_decimal(const char **fmt)
+{
+	unsigned int value = 0;
+
+	while (**fmt >= '0' && **fmt <= '9') {
+		value = value * 10 + (*(*fmt)++ - '0');
+	}
+	return value;
+}
+
+static unsigned int
+format_number(kformat_put_t put,
+    void *ctx,
+    const struct format_spec *spec,
+    const char *prefix,
+    unsigned int value,
+    unsigned int base,
+    const char *letters)
+{
+	char digits[32];
+	unsigned int count = sizeof(digits);
+
+	do {
+		digits[--count] = letters[value % base];
+		value /= base;
+	} while (value);
+	return format_emit(put, ctx, spec, prefix, digits + count,
+	    sizeof(digits) - count);
+}
+
+int
+kformat(kformat_put_t put, void *ctx, const char *fmt, va_list args)
+{
+	struct format_spec spec;
+	const char *str;
+	unsigned int written = 0, len, addr;
+	char digits[8], ch;
+	int value;
+
+	for (; *fmt; fmt++) {
+		if (*fmt != '%') {
+			put(ctx, *fmt);
+			written++;
+			continue;
+		}
+
+		/* Flags, field width, precision and length. */
+		spec.flags = 0;
+		spec.width = 0;
+		spec.precision = -1;
+		for (fmt++; *fmt == '-' || *fmt == '0'; fmt++) {
+			spec.flags |= *fmt == '-' ? FORMAT_LEFT : FORMAT_ZERO;
+		}
+		spec.width = format_decimal(&fmt);
+		if (*fmt == '.') {
+			fmt++;
+			spec.precision = format_decimal(&fmt);
+		}
+		if (*fmt == 'l') {
+			fmt++;
+		}
+
+		switch (*fmt) {
+		case 'd':
+			value = va_arg(args, int);
+			if (value < 0) {
+				written += format_number(put, ctx, &spec, "-",
+				    -(unsigned int) value, 10, format_lower);
+			} else {
+				written += format_number(put, ctx, &spec, "",
+				    value, 10, format_lower);
+			}
+			break;
+		case 'u':
+			written += format_number(put, ctx, &spec, "",
+			    va_arg(args, unsigned int), 10, format_lower);
+			break;
+		case 'x':
+			written += format_number(put, ctx, &spec, "",
+			    va_arg(args, unsigned int), 16, format_lower);
+			break;
+		case 'X':
+			written += format_number(put, ctx, &spec, "",
+			    va_arg(args, unsigned int), 16, format_upper);
+			break;
+		case 'p':
+			/* Pointers are always shown with every digit. */
+			addr = (unsigned int) va_arg(args, void *);
+			for (len = 0; len < 8; len++, addr <<= 4) {
+				digits[len] = format_lower[addr >> 28];
+			}
+			spec.flags &= ~FORMAT_ZERO;
+			written += format_emit(put, ctx, &spec, "0x", digits,
+			    sizeof(digits));
+			break;
+		case 's':
+			if ((str = va_arg(args, const char *)) == 0) {
+				str = "(null)";
+			}
+			/* Without a precision, the cast gives no limit. */
+			for (len = 0; str[len]; len++) {
+				if (len == (unsigned int) spec.precision) {
+					break;
+				}
+			}
+			written += format_emit(put, ctx, &spec, "", str, len);
+			break;
+		case 'c':
+			ch = (char) va_arg(args, int);
+			written += format_emit(put, ctx, &spec, "", &ch, 1);
+			break;
+		case '%':
+			put(ctx, '%');
+			written++;
+			break;
+		default:
+			/* Unknown conversion, or the format string ended. */
+			return written;
+		}
+	}
+	return written;
+}
+
+static void
+format_buffer_put(void *ctx, char ch)
+{
+	struct format_buffer *buffer = (struct format_buffer *) ctx;
+
+	if (buffer->len + 1 < buffer->size) {
+		buffer->buf[buffer->len] = ch;
+	}
+	buffer->len++;
+}
+
+int
+vsnprintf(char *buf, size_t size, const char *fmt, va_list args)
+{
+	struct format_buffer buffer = {buf, size, 0};
+
+	kformat(&format_buffer_put, &buffer, fmt, args);
+	if (size) {
+		buf[buffer.len < size ? buffer.len : size - 1] = 0;
+	}
+	return buffer.len;
+}
+
+int
+snprintf(char *buf, size_t size, const char *fmt, ...)
+{
+	va_list args;
+	int len;
+
+	va_start(args, fmt);
+	len = vsnprintf(buf, size, fmt, args);
+	va_end(args);
+	return len;
+}
+
+int
+scnprintf(char *buf, size_t size, const char *fmt, ...)
+{
+	va_list args;
+	int len;
+
+	va_start(args, fmt);
+	len = vsnprintf(buf, size, fmt, args);
+	va_end(args);
+	if ((size_t) len >= size) {
+		len = size ? size - 1 : 0;
+	}
+	return len;
+}
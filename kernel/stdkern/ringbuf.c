@@ -4,21 +4,34 @@
  * SPDX-License-Identifier:  GPL-3.0-only
  */
 
+#include <sys/kmem.h>
 #include <sys/ringbuf.h>
 #include <sys/stdkern.h>
 
+/* Ring buffer descriptors are allocated from their own object cache.  */
+static kmem_cache_t *ringbuf_cache;
+
 ringbuf_t *
 ringbuf_alloc(unsigned int size)
 {
-	ringbuf_t *ringbuf = (ringbuf_t *) malloc(sizeof(ringbuf_t));
+	ringbuf_t *ringbuf;
+
+	if (!ringbuf_cache) {
+		ringbuf_cache = kmem_cache_create("ringbuf", sizeof(ringbuf_t), 0);
+	}
+	if (!ringbuf_cache) {
+		return 0;
+	}
+	ringbuf = (ringbuf_t *) kmem_cache_alloc(ringbuf_cache);
 	if (ringbuf) {
 		ringbuf->size = size;
 		ringbuf->writeptr = 0;
 		ringbuf->readptr = 0;
+		ringbuf->status = 0;
 		ringbuf->buffer = (unsigned char *) malloc(size);
 		/* TODO: Fill the buffer with zeros. */
 		if (!ringbuf->buffer) {
-			free(ringbuf);
+			kmem_cache_free(ringbuf_cache, ringbuf);
 			ringbuf = 0;
 		}
 	}
@@ -68,6 +81,6 @@ ringbuf_free(ringbuf_t *buf)
 {
 	if (buf) {
 		free(buf->buffer);
+		kmem_cache_free(ringbuf_cache, buf);
 	}
-	free(buf);
 }
\ No newline at end of file
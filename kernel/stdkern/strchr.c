@@ -1,13 +1,39 @@
+#include <stddef.h>
+
+#include "strword.h"
+
+char *
+strchrnul(const char *s, int c)
+{
+	const char *ptr = s;
+	const word_t *word;
+	word_t pattern = WORD_REPEAT(c);
+
+	for (; !WORD_ALIGNED(ptr); ptr++) {
+		if (!*ptr || *ptr == (char) c) {
+			return (char *) ptr;
+		}
+	}
+
+	/* Skip the words that have neither the terminator nor the character. */
+	word = (const word_t *) ptr;
+	while (!WORD_HAS_ZERO(*word) && !WORD_HAS_ZERO(*word ^ pattern)) {
+		word++;
+	}
+
+	for (ptr = (const char *) word; *ptr && *ptr != (char) c; ptr++)
+		;
+	return (char *) ptr;
+}
+
 char *
 strchr(const char *s, int c)
 {
-	char *ptr = (char *) s;
-	if (ptr) {
-		while (*ptr) {
-			if (*ptr == c) {
-				return ptr;
-			}
-			ptr++;
+	char *ptr;
+	if (s) {
+		ptr = strchrnul(s, c);
+		if (*ptr) {
+			return ptr;
 		}
 	}
 	return 0;
@@ -18,20 +18,55 @@
 
 #include <stddef.h>
 
+#include "strword.h"
+
+/*
+ * Count how many bytes at the beginning of both strings are equal and are
+ * not the terminator, a word at a time.  Both strings must be aligned.  The
+ * count is a multiple of the word size and it never goes past max, so the
+ * caller has to compare the rest byte by byte.
+ */
+static size_t
+strcmp_words(const unsigned char *s1, const unsigned char *s2, size_t max)
+{
+	const word_t *w1 = (const word_t *) s1;
+	const word_t *w2 = (const word_t *) s2;
+	size_t count = 0;
+
+	while (max - count >= WORD_SIZE && *w1 == *w2 && !WORD_HAS_ZERO(*w1)) {
+		w1++;
+		w2++;
+		count += WORD_SIZE;
+	}
+	return count;
+}
+
 int
 strcmp(const char *s1, const char *s2)
 {
 	unsigned char *cmp1 = (unsigned char *) s1;
 	unsigned char *cmp2 = (unsigned char *) s2;
+	size_t count;
 
-	while (*cmp1 && *cmp2) {
-		if (*cmp1 != *cmp2) {
+	/* Words can only be compared if both strings are equally aligned. */
+	while (!WORD_ALIGNED(cmp1)) {
+		if (!*cmp1 || *cmp1 != *cmp2) {
 			return *cmp1 - *cmp2;
 		}
 		cmp1++;
 		cmp2++;
 	}
 
+	if (WORD_ALIGNED(cmp2)) {
+		count = strcmp_words(cmp1, cmp2, (size_t) -1);
+		cmp1 += count;
+		cmp2 += count;
+	}
+	while (*cmp1 && *cmp1 == *cmp2) {
+		cmp1++;
+		cmp2++;
+	}
+
 	return *cmp1 - *cmp2;
 }
 
@@ -40,20 +75,35 @@ strncmp(const char *s1, const char *s2, size_t n)
 {
 	unsigned char *cmp1 = (unsigned char *) s1;
 	unsigned char *cmp2 = (unsigned char *) s2;
+	size_t count;
 
-	if (n == 0) {
-		/* Early bail out. */
-		return 0;
+	/* Words can only be compared if both strings are equally aligned. */
+	while (n && !WORD_ALIGNED(cmp1)) {
+		if (!*cmp1 || *cmp1 != *cmp2) {
+			return *cmp1 - *cmp2;
+		}
+		cmp1++;
+		cmp2++;
+		n--;
+	}
+
+	if (WORD_ALIGNED(cmp2)) {
+		count = strcmp_words(cmp1, cmp2, n);
+		cmp1 += count;
+		cmp2 += count;
+		n -= count;
 	}
 
 	/* Bail as soon as any string ends. */
-	while (*cmp1 && *cmp2 && n--) {
-		if (*cmp1 != *cmp2) {
-			return *cmp1 - *cmp2;
-		}
+	while (n && *cmp1 && *cmp1 == *cmp2) {
 		cmp1++;
 		cmp2++;
+		n--;
 	}
 
+	/* Every one of the n characters was equal. */
+	if (n == 0) {
+		return 0;
+	}
 	return *cmp1 - *cmp2;
 }
@@ -18,11 +18,22 @@
 
 #include <stddef.h>
 
+#include "strword.h"
+
 size_t
 strlen(const char *s)
 {
 	const char *ptr;
-	for (ptr = s; *ptr; ptr++)
+	const word_t *word;
+
+	for (ptr = s; !WORD_ALIGNED(ptr); ptr++) {
+		if (!*ptr) {
+			return ptr - s;
+		}
+	}
+	for (word = (const word_t *) ptr; !WORD_HAS_ZERO(*word); word++)
+		;
+	for (ptr = (const char *) word; *ptr; ptr++)
 		;
 	return ptr - s;
 }
@@ -20,7 +20,7 @@ matches(char chr, char *delims)
 char *
 strsep(char **strptr, const char *delimiter)
 {
-	char *delim, *strcur, *origstrptr;
+	char *strcur, *origstrptr;
 
 	if (!strptr || !*strptr) {
 		/* Shortcircuit to NULL if given strptr is NULL. */
@@ -29,20 +29,21 @@ strsep(char **strptr, const char *delimiter)
 
 	strcur = *strptr;
 	origstrptr = *strptr;
-	while (*strcur) {
-		delim = (char *) delimiter;
-		while (*delim) {
-			if (*delim == *strcur) {
-				*strcur = 0;
-				*strptr = (strcur + 1);
-				return origstrptr;
-			}
-			delim++;
+	if (delimiter[0] && !delimiter[1]) {
+		/* A single delimiter like "/" is found a word at a time. */
+		strcur = strchrnul(strcur, delimiter[0]);
+	} else {
+		while (*strcur && !matches(*strcur, (char *) delimiter)) {
+			strcur++;
 		}
-		strcur++;
 	}
 
-	/* When nothing matched, it will return NULL via the pointer. */
-	*strptr = 0;
+	if (*strcur) {
+		*strcur = 0;
+		*strptr = (strcur + 1);
+	} else {
+		/* When nothing matched, it will return NULL via the pointer. */
+		*strptr = 0;
+	}
 	return origstrptr;
 }
@@ -0,0 +1,34 @@
+/*
+ * This file is part of NativeOS
+ * Copyright (C) 2015-2022 The NativeOS contributors
+ * SPDX-License-Identifier:  GPL-3.0-only
+ */
+
+#pragma once
+
+/**
+ * \file
+ * \brief Helpers for the string functions that work a word at a time
+ *
+ * Strings and buffers are scanned by loading one aligned word at a time and
+ * testing all of its bytes at once.  An aligned word never crosses a page
+ * boundary, so the bytes that follow the end in the same word can be read
+ * even if the string ends right before an unmapped page.
+ */
+
+#include <stddef.h>
+
+/** A word that may alias the characters of a string.  */
+typedef unsigned int __attribute__((may_alias)) word_t;
+
+#define WORD_SIZE sizeof(word_t)
+
+/** Test whether a pointer is aligned to the word size.  */
+#define WORD_ALIGNED(ptr) (((unsigned int) (ptr) & (WORD_SIZE - 1)) == 0)
+
+/** Repeat a byte in every byte of a word.  */
+#define WORD_REPEAT(byte) ((word_t) (unsigned char) (byte) * 0x01010101U)
+
+/** Non-zero if any of the bytes of the word is zero.  */
+#define WORD_HAS_ZERO(word) \
+	(((word) - 0x01010101U) & ~(word) & 0x80808080U)
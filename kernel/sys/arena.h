@@ -0,0 +1,94 @@
+/*
+ * This file is part of NativeOS
+ * Copyright (C) 2015-2022 The NativeOS contributors
+ * SPDX-License-Identifier:  GPL-3.0-only
+ */
+
+#pragma once
+
+/**
+ * \file
+ * \brief Arena allocator
+ *
+ * An arena hands out memory from a buffer by just moving a pointer forward,
+ * and every allocation made in the arena is released at once when the arena
+ * is reset or destroyed.  It is meant for short-lived allocations that are
+ * made while a task is running and that are not required once the task is
+ * complete, so that they do not leave holes in the kernel heap.
+ *
+ * The first buffer of an arena may be a buffer in the stack of the caller.
+ * If the arena runs out of space, additional chunks are requested to the
+ * kernel heap, and they are given back when the arena is reset.
+ */
+
+#include <stddef.h>
+
+struct arena_chunk;
+
+typedef struct arena {
+	/** The buffer where allocations are being made now. */
+	unsigned char *base;
+	/** The size of the current buffer. */
+	size_t size;
+	/** The amount of bytes of the current buffer already handed out. */
+	size_t used;
+	/** The first buffer of the arena. */
+	unsigned char *first;
+	/** The size of the first buffer of the arena. */
+	size_t first_size;
+	/** Non-zero if the first buffer was allocated by arena_create. */
+	int owned;
+	/** Chunks requested to the heap after the first buffer was full. */
+	struct arena_chunk *chunks;
+} arena_t;
+
+/**
+ * \brief Initialise an arena on top of a buffer owned by the caller.
+ * \param arena the arena to initialise.
+ * \param buf the buffer where allocations will be made, such as an array in
+ *            the stack of the caller.  It must outlive the arena.
+ * \param size the size of the buffer.
+ */
+void arena_init(arena_t *arena, void *buf, size_t size);
+
+/**
+ * \brief Initialise an arena on top of a buffer allocated in the heap.
+ * \param arena the arena to initialise.
+ * \param size the size of the buffer to allocate.
+ * \return 0 if the arena was created, -1 if there is no memory available.
+ */
+int arena_create(arena_t *arena, size_t size);
+
+/**
+ * \brief Allocate memory from an arena.
+ * \param arena the arena to allocate the memory from.
+ * \param size the amount of bytes to allocate.
+ * \return a pointer to the memory, or NULL if no memory is available.
+ */
+void *arena_alloc(arena_t *arena, size_t size);
+
+/**
+ * \brief Make a copy of a string in an arena.
+ * \param arena the arena to allocate the copy from.
+ * \param str the string to copy.
+ * \return a pointer to the copy, or NULL if no memory is available.
+ */
+char *arena_strdup(arena_t *arena, const char *str);
+
+/**
+ * \brief Release every allocation made in an arena.
+ *
+ * The arena can be used again after being reset.
+ *
+ * \param arena the arena to reset.
+ */
+void arena_reset(arena_t *arena);
+
+/**
+ * \brief Release every allocation made in an arena and the arena buffer.
+ *
+ * The arena cannot be used again until it is initialised again.
+ *
+ * \param arena the arena to destroy.
+ */
+void arena_destroy(arena_t *arena);
@@ -0,0 +1,67 @@
+/*
+ * This file is part of NativeOS
+ * Copyright (C) 2015-2022 The NativeOS contributors
+ * SPDX-License-Identifier:  GPL-3.0-only
+ */
+
+#pragma once
+
+/**
+ * \file
+ * \brief Kernel object caches
+ *
+ * An object cache hands out objects of a single, fixed size.  Most of the
+ * data structures used by the kernel have a fixed size (list nodes, VFS
+ * nodes...), so instead of asking the heap for each one of them, paying the
+ * size of the control block and the time to find a free region, they are
+ * carved out of slabs.  A slab is a memory page that is split in as many
+ * objects as fit into it.
+ */
+
+#include <stddef.h>
+
+typedef struct kmem_cache kmem_cache_t;
+
+/** Constructor used to initialise objects handed out by a cache. */
+typedef void (*kmem_ctor_t)(void *obj);
+
+/**
+ * \brief Create an object cache.
+ *
+ * The cache will be empty, and slabs will be requested as objects are
+ * allocated.  The object size cannot be larger than what fits in a slab
+ * once the slab header is accounted.
+ *
+ * \param name a descriptive name for the cache, for debugging purposes.
+ * \param size the size in bytes of each object handed out by the cache.
+ * \param ctor an optional constructor, called on objects before returning
+ *             them from kmem_cache_alloc.  May be NULL.
+ * \return the new object cache, or NULL in case of error.
+ */
+kmem_cache_t *
+kmem_cache_create(const char *name, size_t size, kmem_ctor_t ctor);
+
+/**
+ * \brief Allocate an object from a cache.
+ * \param cache the cache to allocate the object from.
+ * \return a pointer to the object, or NULL if no memory is available.
+ */
+void *kmem_cache_alloc(kmem_cache_t *cache);
+
+/**
+ * \brief Return an object to the cache it was allocated from.
+ * \param cache the cache that handed out the object.
+ * \param obj the object to return to the cache.
+ */
+void kmem_cache_free(kmem_cache_t *cache, void *obj);
+
+/**
+ * \brief Destroy an object cache.
+ *
+ * Every slab owned by the cache is released, even if there are objects that
+ * are still in use, so this should only be called once every object in the
+ * cache has been returned.
+ *
+ * \param cache the cache to destroy.
+ */
+void kmem_cache_destroy(kmem_cache_t *cache);
@@ -0,0 +1,124 @@
+/*
+ * This file is part of NativeOS
+ * Copyright (C) 2015-2022 The NativeOS contributors
+ * SPDX-License-Identifier:  GPL-3.0-only
+ */
+
+#pragma once
+
+/**
+ * \file
+ * \brief Formatted output
+ *
+ * The formatting engine understands the %d, %u, %x, %X, %s, %c and %p
+ * conversions and %%.  Each conversion may have the '-' flag to pad on the
+ * right, the '0' flag to pad numbers with zeros, a field width and, for
+ * strings, a precision that cuts the string.  An 'l' length modifier is
+ * accepted and ignored, since long is as wide as int.
+ *
+ * The engine never allocates memory.  Text is written either into a buffer
+ * given by the caller (snprintf and friends) or into a sink.  A sink keeps
+ * a small buffer in front of a VFS node and only calls fs_write when a line
+ * is complete, when the buffer is full or when the sink is flushed, so that
+ * devices such as the serial port or the virtual console receive whole
+ * lines at once instead of single characters.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <sys/vfs.h>
+
+/** Size of the buffer of a sink.  Longer lines are written in pieces.  */
+#define KSINK_SIZE 128
+
+/** Called by the engine once for every character of the output.  */
+typedef void (*kformat_put_t)(void *ctx, char ch);
+
+/** A buffered output towards a VFS node.  */
+struct ksink {
+	/** The node where the output is written to.  May be NULL. */
+	vfs_node_t *node;
+	/** The offset given to fs_write, for block devices. */
+	unsigned int offset;
+	/** The amount of bytes waiting in the buffer. */
+	unsigned int len;
+	char buf[KSINK_SIZE];
+};
+
+/**
+ * \brief Format text and hand it to a callback.
+ * \param put the function that receives every character.
+ * \param ctx an opaque pointer that is given to put.
+ * \param fmt the format string.
+ * \param args the arguments for the conversions in the format string.
+ * \return the amount of characters given to put.
+ */
+int kformat(kformat_put_t put, void *ctx, const char *fmt, va_list args);
+
+/**
+ * \brief Format text into a buffer.
+ *
+ * The text is cut if it does not fit, but it is always terminated as long
+ * as size is not zero.
+ *
+ * \param buf the buffer where to write the text.
+ * \param size the size of the buffer.
+ * \param fmt the format string.
+ * \return the length the text would have if the buffer was big enough.
+ */
+int snprintf(char *buf, size_t size, const char *fmt, ...);
+int vsnprintf(char *buf, size_t size, const char *fmt, va_list args);
+
+/**
+ * \brief Format text into a buffer, returning what was actually written.
+ *
+ * This behaves like snprintf, but the return value never exceeds the
+ * space in the buffer, so it can be used to append text to a buffer piece
+ * by piece without checking for truncation after each piece.
+ *
+ * \return the amount of characters written, not counting the terminator.
+ */
+int scnprintf(char *buf, size_t size, const char *fmt, ...);
+
+/**
+ * \brief Prepare a sink that writes into a VFS node.
+ * \param sink the sink to initialise.
+ * \param node the node where the output will be written.  It must be open.
+ */
+void ksink_init(struct ksink *sink, vfs_node_t *node);
+
+/**
+ * \brief Format text into a sink.
+ *
+ * Complete lines are written to the node straight away, but the last line
+ * stays in the buffer until it is completed or ksink_flush is called.
+ *
+ * \param sink the sink where to write the text.
+ * \param fmt the format string.
+ * \return the amount of characters written into the sink.
+ */
+int ksink_printf(struct ksink *sink, const char *fmt, ...);
+int ksink_vprintf(struct ksink *sink, const char *fmt, va_list args);
+
+/**
+ * \brief Write whatever is waiting in the buffer of a sink.
+ * \param sink the sink to flush.
+ */
+void ksink_flush(struct ksink *sink);
+
+/**
+ * \brief Set the node where kprintf writes to.
+ * \param node the node, usually the virtual console.  It must be open.
+ */
+void kprintf_attach(vfs_node_t *node);
+
+/**
+ * \brief Format text into the kernel console.
+ *
+ * The text is written with one fs_write per line.  Nothing is written
+ * until kprintf_attach is called.
+ *
+ * \param fmt the format string.
+ * \return the amount of characters written.
+ */
+int kprintf(const char *fmt, ...);
@@ -33,6 +33,23 @@ void *malloc(size_t size);
  */
 void free(void *ptr);
 
+/**
+ * @brief Change the size of a memory buffer allocated in the heap.
+ * @param ptr a pointer to the memory buffer to resize, or NULL.
+ * @param size the new amount of bytes for the memory buffer.
+ * @return a pointer to the resized buffer (which may have been moved) or
+ *         NULL if there was an error, leaving the original buffer untouched.
+ */
+void *realloc(void *ptr, size_t size);
+
+/**
+ * @brief Allocate some memory buffer in the heap with a given alignment.
+ * @param alignment the alignment for the buffer, must be a power of two.
+ * @param size the amount of bytes to allocate in the heap.
+ * @return a pointer to the allocated buffer or NULL if there was an error.
+ */
+void *aligned_alloc(size_t alignment, size_t size);
+
 /**
  * @brief Copies the given number of characters from one buffer to other.
  * @param dst the target buffer to copy data to.
@@ -41,6 +58,33 @@ void free(void *ptr);
  */
 void *memcpy(void *dst, const void *src, size_t count);
 
+/**
+ * @brief Copies bytes from one buffer to other, even if they overlap.
+ * @param dst the target buffer to copy data to.
+ * @param src the source buffer to copy data from.
+ * @param count the amount of bytes to transfer from source to dest.
+ * @return a pointer to the target buffer.
+ */
+void *memmove(void *dst, const void *src, size_t count);
+
+/**
+ * @brief Compares the given number of bytes from two buffers.
+ * @param s1 the first buffer to compare
+ * @param s2 the second buffer to compare
+ * @param count the amount of bytes to compare
+ * @return <0 if s1 < s2, >0 if s1 > s2, 0 if s1 == s2
+ */
+int memcmp(const void *s1, const void *s2, size_t count);
+
+/**
+ * @brief Locates the first ocurrence of a byte in the given buffer.
+ * @param s the buffer where the search has to be performed.
+ * @param c the byte to locate in the buffer.
+ * @param count the size of the buffer.
+ * @return either a pointer to the byte, or NULL if not found.
+ */
+void *memchr(const void *s, int c, size_t count);
+
 /**
  * @brief Sets every byte in the given buffer region to a value.
  * @param dest the target buffer where to set the values in.
@@ -75,6 +119,15 @@ char *strncat(char *s1, const char *s2, size_t count);
  */
 char *strchr(const char *s, int c);
 
+/**
+ * @brief Locates the first ocurrence of the character c in the string s.
+ * @param s the string where the search has to be performed.
+ * @param c the character to locate in the string.
+ * @return either a pointer to the in-string character, or a pointer to the
+ *         terminator of the string if not found.
+ */
+char *strchrnul(const char *s, int c);
+
 /**
  * @brief Locates the last ocurrence of the character c in the string s.
  * @param s the string where the search has to be performed.
@@ -145,6 +145,22 @@ typedef struct vfs_ops {
 	 * \return a pointer to the child VFS ndoe or NULL.
 	 */
 	struct vfs_node *(*vfs_finddir)(struct vfs_node *node, char *nodename);
+
+	/**
+	 * \brief Get the memory that holds the contents of a VFS node
+	 *
+	 * This hook can only be implemented by regular files.
+	 *
+	 * File systems whose files already sit in memory, such as ramdisks,
+	 * can use this hook to expose the contents of a file without copying
+	 * them. The memory must not be written: callers that want a writable
+	 * copy should map it privately with vmap_private.
+	 *
+	 * \param node the VFS node whose contents are requested
+	 * \param size where to store the size of the contents in bytes
+	 * \return a pointer to the contents, or NULL if not in memory.
+	 */
+	const void *(*vfs_mmap)(struct vfs_node *node, unsigned int *size);
 } vfs_ops_t;
 
 typedef struct vfs_node {
@@ -199,6 +215,23 @@ typedef struct vfs_filesys {
 
 void vfs_init(void);
 
+/**
+ * \brief Allocate a VFS node.
+ *
+ * File system drivers should use this function to allocate the VFS nodes
+ * they expose, because VFS nodes are allocated from an object cache instead
+ * of the kernel heap.  The returned node is zero-filled.
+ *
+ * \return a pointer to the VFS node, or NULL if there is no memory.
+ */
+vfs_node_t *vfs_node_alloc(void);
+
+/**
+ * \brief Free a VFS node previously allocated with vfs_node_alloc.
+ * \param node the VFS node to free.
+ */
+void vfs_node_free(vfs_node_t *node);
+
 int vfs_mount(char *driver, char *name, void *argp);
 int vfs_umount(char *mountname);
 
@@ -220,3 +253,4 @@ int fs_ioctl(vfs_node_t *node, int iorq, void *args);
 int fs_close(vfs_node_t *node);
 vfs_node_t *fs_readdir(vfs_node_t *node, unsigned int index);
 vfs_node_t *fs_finddir(vfs_node_t *node, char *name);
+const void *fs_mmap(vfs_node_t *node, unsigned int *size);
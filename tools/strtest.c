@@ -0,0 +1,400 @@
+/*
+ * This file is part of NativeOS
+ * Copyright (C) 2015-2022 The NativeOS contributors
+ * SPDX-License-Identifier:  GPL-3.0-only
+ */
+
+/*
+ * Host check for the string functions of stdkern.
+ *
+ * The kernel sources are compiled into this program with their symbols
+ * renamed, and run against random strings placed right before a page that
+ * cannot be read, so that scanning past the terminator into the next page
+ * faults.  Every result is compared with libc and with the byte loops that
+ * stdkern used before it learned to scan a word at a time.
+ *
+ * Build and run it from the root of the repository with the system cc:
+ *
+ *   cc -O2 -Ikernel -Wno-pointer-to-int-cast -o strtest tools/strtest.c
+ *   ./strtest
+ *
+ * It prints the amount of checks and mismatches and fails if there was any
+ * mismatch.  Run it as "./strtest -t" to time the stdkern functions against
+ * the byte loops instead, for several lengths and alignments.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define strlen k_strlen
+#define strnlen k_strnlen
+#define strcmp k_strcmp
+#define strncmp k_strncmp
+#define strchr k_strchr
+#define strchrnul k_strchrnul
+#define strrchr k_strrchr
+#define strsep k_strsep
+#define strcat k_strcat
+#define strncat k_strncat
+#define strcpy k_strcpy
+#define strncpy k_strncpy
+#define strdup k_strdup
+
+#include "../kernel/stdkern/strlen.c"
+#include "../kernel/stdkern/strcmp.c"
+#include "../kernel/stdkern/strchr.c"
+#include "../kernel/stdkern/strsep.c"
+
+#undef strlen
+#undef strnlen
+#undef strcmp
+#undef strncmp
+#undef strchr
+#undef strchrnul
+#undef strrchr
+#undef strsep
+#undef strcat
+#undef strncat
+#undef strcpy
+#undef strncpy
+#undef strdup
+
+#define ITERATIONS 300000
+#define MAXLEN 40
+
+/* Calls per timing, and the longest string that is timed.  */
+#define TIMING_CALLS 2000000
+#define TIMING_MAXLEN 256
+
+/* The byte loops, as they were before the word-at-a-time versions.  */
+
+static size_t
+ref_strlen(const char *s)
+{
+	const char *ptr;
+	for (ptr = s; *ptr; ptr++)
+		;
+	return ptr - s;
+}
+
+static int
+ref_strcmp(const char *s1, const char *s2)
+{
+	unsigned char *cmp1 = (unsigned char *) s1;
+	unsigned char *cmp2 = (unsigned char *) s2;
+
+	while (*cmp1 && *cmp2) {
+		if (*cmp1 != *cmp2) {
+			return *cmp1 - *cmp2;
+		}
+		cmp1++;
+		cmp2++;
+	}
+
+	return *cmp1 - *cmp2;
+}
+
+static char *
+ref_strchr(const char *s, int c)
+{
+	char *ptr = (char *) s;
+	if (ptr) {
+		while (*ptr) {
+			if (*ptr == c) {
+				return ptr;
+			}
+			ptr++;
+		}
+	}
+	return 0;
+}
+
+static char *
+ref_strsep(char **strptr, const char *delimiter)
+{
+	char *delim, *strcur, *origstrptr;
+
+	if (!strptr || !*strptr) {
+		return 0;
+	}
+
+	strcur = *strptr;
+	origstrptr = *strptr;
+	while (*strcur) {
+		delim = (char *) delimiter;
+		while (*delim) {
+			if (*delim == *strcur) {
+				*strcur = 0;
+				*strptr = (strcur + 1);
+				return origstrptr;
+			}
+			delim++;
+		}
+		strcur++;
+	}
+
+	*strptr = 0;
+	return origstrptr;
+}
+
+static long checks, mismatches;
+
+static void
+check(int ok, const char *what, const char *s1, const char *s2)
+{
+	checks++;
+	if (!ok) {
+		if (mismatches++ < 10) {
+			fprintf(stderr, "%s mismatch: \"%s\" \"%s\"\n", what, s1,
+			    s2 ? s2 : "");
+		}
+	}
+}
+
+static int
+sign(int value)
+{
+	return (value > 0) - (value < 0);
+}
+
+/* Map a page followed by one that cannot be read.  */
+static char *
+guarded_page(size_t pagesize)
+{
+	char *page;
+
+	page = mmap(0, 2 * pagesize, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (page == MAP_FAILED
+	    || mprotect(page + pagesize, pagesize, PROT_NONE)) {
+		perror("mmap");
+		exit(1);
+	}
+	return page;
+}
+
+/* Fill with a small alphabet, so that strings share long prefixes.  */
+static void
+random_string(char *str, size_t len, int high)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		str[i] = 'a' + rand() % 3;
+		if (high && rand() % 5 == 0) {
+			str[i] = (char) (0x80 + rand() % 3);
+		}
+	}
+	str[len] = 0;
+}
+
+/* Offset of a pointer returned by strsep, or -1 if it is NULL.  */
+static long
+offset(const char *ptr, const char *base)
+{
+	return ptr ? ptr - base : -1;
+}
+
+static void
+check_strsep(char *str, const char *delim)
+{
+	char libc[MAXLEN + 1], ref[MAXLEN + 1], orig[MAXLEN + 1];
+	char *ptr1 = str, *ptr2 = libc, *ptr3 = ref, *tok1, *tok2, *tok3;
+	size_t len = strlen(str);
+
+	memcpy(orig, str, len + 1);
+	memcpy(libc, str, len + 1);
+	memcpy(ref, str, len + 1);
+	tok1 = k_strsep(&ptr1, delim);
+	tok2 = strsep(&ptr2, delim);
+	tok3 = ref_strsep(&ptr3, delim);
+	check(offset(tok1, str) == offset(tok2, libc)
+	          && offset(ptr1, str) == offset(ptr2, libc)
+	          && offset(tok1, str) == offset(tok3, ref)
+	          && offset(ptr1, str) == offset(ptr3, ref)
+	          && !memcmp(str, libc, len + 1) && !memcmp(str, ref, len + 1),
+	    "strsep", orig, delim);
+}
+
+/*
+ * Every call goes through a pointer read from a volatile, so that the
+ * compiler cannot inline the functions into the timing loops or hoist
+ * the calls out of them.
+ */
+typedef size_t (*strlen_fn)(const char *);
+typedef int (*strcmp_fn)(const char *, const char *);
+typedef char *(*strchr_fn)(const char *, int);
+typedef char *(*strsep_fn)(char **, const char *);
+
+static volatile size_t sink;
+
+static double
+elapsed(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((now.tv_sec - start->tv_sec) * 1e9
+	    + (now.tv_nsec - start->tv_nsec)) / TIMING_CALLS;
+}
+
+static double
+time_strlen(strlen_fn volatile fn, const char *s)
+{
+	struct timespec start;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < TIMING_CALLS; i++) {
+		sink += fn(s);
+	}
+	return elapsed(&start);
+}
+
+static double
+time_strcmp(strcmp_fn volatile fn, const char *s1, const char *s2)
+{
+	struct timespec start;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < TIMING_CALLS; i++) {
+		sink += fn(s1, s2);
+	}
+	return elapsed(&start);
+}
+
+static double
+time_strchr(strchr_fn volatile fn, const char *s, int c)
+{
+	struct timespec start;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < TIMING_CALLS; i++) {
+		sink += (size_t) fn(s, c);
+	}
+	return elapsed(&start);
+}
+
+/* The delimiter is never found, so the string is not modified.  */
+static double
+time_strsep(strsep_fn volatile fn, char *s)
+{
+	struct timespec start;
+	char *ptr;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < TIMING_CALLS; i++) {
+		ptr = s;
+		sink += (size_t) fn(&ptr, "/");
+	}
+	return elapsed(&start);
+}
+
+static void
+report(const char *what, size_t len, int align, double old, double new)
+{
+	printf("%-8s %4zu %5d %9.1f %9.1f %7.2fx\n", what, len, align, old, new,
+	    old / new);
+}
+
+/*
+ * Time the byte loops and the stdkern functions in nanoseconds per call.
+ * The second string of strcmp is equal to the first one, so the whole
+ * string is compared, and it is placed at the given alignment too, so
+ * both equal and unequal alignments are timed.
+ */
+static void
+timing(void)
+{
+	static const size_t lengths[] = {4, 16, 64, 256};
+	static char buf1[TIMING_MAXLEN + 8], buf2[TIMING_MAXLEN + 8];
+	size_t len;
+	char *s1, *s2;
+	unsigned int i;
+	int align;
+
+	printf("%-8s %4s %5s %9s %9s %8s\n", "function", "len", "align",
+	    "old ns", "new ns", "speedup");
+	for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+		len = lengths[i];
+		for (align = 0; align < 4; align++) {
+			s1 = (char *) (((size_t) buf1 + 3) & ~(size_t) 3) + align;
+			s2 = (char *) (((size_t) buf2 + 3) & ~(size_t) 3);
+			memset(s1, 'a', len);
+			s1[len] = 0;
+			memcpy(s2, s1, len + 1);
+
+			report("strlen", len, align, time_strlen(ref_strlen, s1),
+			    time_strlen(k_strlen, s1));
+			report("strcmp", len, align,
+			    time_strcmp(ref_strcmp, s1, s2),
+			    time_strcmp(k_strcmp, s1, s2));
+			report("strchr", len, align,
+			    time_strchr(ref_strchr, s1, 'z'),
+			    time_strchr(k_strchr, s1, 'z'));
+			report("strsep", len, align, time_strsep(ref_strsep, s1),
+			    time_strsep(k_strsep, s1));
+		}
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	static const char chars[] = "abc\x80\x81";
+	size_t pagesize = sysconf(_SC_PAGESIZE), len1, len2, n, same;
+	char *page1, *page2, *s1, *s2;
+	int c, i;
+
+	if (argc > 1 && !strcmp(argv[1], "-t")) {
+		timing();
+		return 0;
+	}
+
+	page1 = guarded_page(pagesize);
+	page2 = guarded_page(pagesize);
+	srand(1);
+
+	for (i = 0; i < ITERATIONS; i++) {
+		/* Both strings end right before the guard page. */
+		len1 = rand() % MAXLEN;
+		len2 = rand() % MAXLEN;
+		s1 = page1 + pagesize - len1 - 1;
+		s2 = page2 + pagesize - len2 - 1;
+		random_string(s1, len1, rand() % 4 == 0);
+		random_string(s2, len2, 0);
+		if (rand() % 2) {
+			same = len1 < len2 ? len1 : len2;
+			memcpy(s2, s1, same);
+		}
+		n = rand() % (MAXLEN + 5);
+		c = chars[rand() % (sizeof(chars) - 1)];
+
+		check(k_strlen(s1) == strlen(s1)
+		          && k_strlen(s1) == ref_strlen(s1),
+		    "strlen", s1, 0);
+		check(sign(k_strcmp(s1, s2)) == sign(strcmp(s1, s2))
+		          && sign(k_strcmp(s1, s2)) == sign(ref_strcmp(s1, s2)),
+		    "strcmp", s1, s2);
+		/* The byte loop read past the nth character, so only libc. */
+		check(sign(k_strncmp(s1, s2, n)) == sign(strncmp(s1, s2, n)),
+		    "strncmp", s1, s2);
+		check(k_strchr(s1, c) == strchr(s1, c)
+		          && k_strchr(s1, c) == ref_strchr(s1, c),
+		    "strchr", s1, 0);
+		check(k_strchrnul(s1, c) == (strchr(s1, c) ? strchr(s1, c)
+		                                            : s1 + len1),
+		    "strchrnul", s1, 0);
+		check_strsep(s1, rand() % 2 ? "b" : "bc");
+	}
+
+	printf("%ld checks, %ld mismatches\n", checks, mismatches);
+	return mismatches != 0;
+}